@@ -0,0 +1,202 @@
+// -----------------------------------------------------------
+// Circuit class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// the gates of a boolean circuit combining a table of atomic
+// predicates into the values of logical expressions, shared by
+// RuleSet and Plan. the caller owns the predicates, the circuit
+// hands every atomic expression to it and builds the gates for
+// the connectives above them. gates that occur in several
+// expressions are built once.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "Inspection.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+namespace tc
+{
+
+    template <typename T>
+    class Circuit final
+    {
+    private:
+        // -----------------------------------------------------------
+        // a gate of the circuit, inputs index the predicate table
+        // followed by the gates. unary gates have no second input
+        // -----------------------------------------------------------
+        struct Gate
+        {
+            CONNECTIVE connective;
+            size_t input1;
+            size_t input2;
+            std::function<bool(bool)> modifier;
+            std::function<bool(bool, bool)> combiner;
+        };
+
+        // while compiling, references to gates are flagged with the
+        // highest bit, they are moved behind the predicates by finish
+        static const size_t GATE_FLAG = ~(~size_t(0) >> 1);
+        static const size_t NO_INPUT = ~size_t(0);
+
+        typedef std::tuple<int, size_t, size_t> GateKey;
+
+        std::vector<Gate> m_gates;
+        size_t m_numPredicates;
+        // only needed while compiling
+        std::map<const LogicalExpressionBehavior<T>*, size_t> m_visited;
+        std::map<GateKey, size_t> m_gateKeys;
+
+    public:
+        Circuit() : m_numPredicates(0) {}
+        ~Circuit() {}
+
+        size_t size() const { return m_gates.size(); }
+
+        // -----------------------------------------------------------
+        // add the gates of an expression. addPredicate(leb, node) is
+        // called once for every atomic expression object and returns
+        // its index in the predicate table of the caller. returns the
+        // reference to the value of the expression, see finish
+        // -----------------------------------------------------------
+        template <typename AddPredicate>
+        size_t compile(const std::shared_ptr<LogicalExpressionBehavior<T>> &leb, AddPredicate &addPredicate)
+        {
+            auto it = m_visited.find(leb.get());
+            if (it != m_visited.end())
+                return it->second;
+
+            size_t ref;
+            const ExpressionNode<T> node = Inspection<T>::node(*leb);
+            if (node.kind == EXPR_COMBINED)
+            {
+                size_t in1 = compile(*node.operands[0], addPredicate);
+                size_t in2 = compile(*node.operands[1], addPredicate);
+                if (node.connective == LOGIC_CUSTOM)
+                    ref = addGate(Gate{ LOGIC_CUSTOM, in1, in2, nullptr, *node.combiner });
+                else
+                    // all predefined binary connectives are commutative
+                    ref = addGate(node.connective, std::min(in1, in2), std::max(in1, in2));
+            }
+            else if (node.kind == EXPR_MODIFIED)
+            {
+                size_t in = compile(*node.operands[0], addPredicate);
+                if (node.connective == LOGIC_CUSTOM)
+                    ref = addGate(Gate{ LOGIC_CUSTOM, in, NO_INPUT, *node.modifier, nullptr });
+                else
+                    ref = addGate(node.connective, in, NO_INPUT);
+            }
+            else
+                ref = addPredicate(leb, node);
+
+            m_visited[leb.get()] = ref;
+            return ref;
+        }
+
+        // -----------------------------------------------------------
+        // place the gates behind the numPredicates predicates of the
+        // caller and turn the references returned by compile into
+        // table indices
+        // -----------------------------------------------------------
+        void finish(size_t numPredicates, std::vector<size_t> &refs)
+        {
+            m_numPredicates = numPredicates;
+            for (auto & g : m_gates)
+            {
+                g.input1 = resolve(g.input1);
+                g.input2 = resolve(g.input2);
+            }
+            for (auto & r : refs)
+                r = resolve(r);
+
+            m_visited.clear();
+            m_gateKeys.clear();
+        }
+
+        // -----------------------------------------------------------
+        // run the gates on the predicate values of n vectors. entry i
+        // of vector r is table[i * stride + r], the gates write their
+        // values behind the predicates in the same way
+        // -----------------------------------------------------------
+        void run(unsigned char *table, size_t stride, size_t n) const
+        {
+            for (size_t g = 0; g < m_gates.size(); ++g)
+            {
+                const Gate &gate = m_gates[g];
+                const unsigned char *a = table + gate.input1 * stride;
+                const unsigned char *b = gate.input2 == NO_INPUT ? nullptr : table + gate.input2 * stride;
+                unsigned char *out = table + (m_numPredicates + g) * stride;
+                switch (gate.connective)
+                {
+                case LOGIC_AND:
+                    for (size_t r = 0; r < n; ++r)
+                        out[r] = a[r] & b[r];
+                    break;
+                case LOGIC_OR:
+                    for (size_t r = 0; r < n; ++r)
+                        out[r] = a[r] | b[r];
+                    break;
+                case LOGIC_EQUAL:
+                    for (size_t r = 0; r < n; ++r)
+                        out[r] = a[r] == b[r];
+                    break;
+                case LOGIC_NOT_EQUAL:
+                    for (size_t r = 0; r < n; ++r)
+                        out[r] = a[r] != b[r];
+                    break;
+                case LOGIC_NOT:
+                    for (size_t r = 0; r < n; ++r)
+                        out[r] = !a[r];
+                    break;
+                default:
+                    if (!b)
+                    {
+                        for (size_t r = 0; r < n; ++r)
+                            out[r] = gate.modifier(a[r] != 0);
+                    }
+                    else
+                    {
+                        for (size_t r = 0; r < n; ++r)
+                            out[r] = gate.combiner(a[r] != 0, b[r] != 0);
+                    }
+                }
+            }
+        }
+
+    private:
+        size_t resolve(size_t ref) const
+        {
+            if (ref == NO_INPUT || !(ref & GATE_FLAG))
+                return ref;
+            return m_numPredicates + (ref & ~GATE_FLAG);
+        }
+
+        size_t addGate(Gate gate)
+        {
+            m_gates.push_back(std::move(gate));
+            return (m_gates.size() - 1) | GATE_FLAG;
+        }
+
+        // predefined connectives on the same inputs are one gate
+        size_t addGate(CONNECTIVE connective, size_t input1, size_t input2)
+        {
+            GateKey key(connective, input1, input2);
+            auto it = m_gateKeys.find(key);
+            if (it != m_gateKeys.end())
+                return it->second;
+
+            return m_gateKeys[key] = addGate(Gate{ connective, input1, input2, nullptr, nullptr });
+        }
+    };
+
+    template <typename T> const size_t Circuit<T>::GATE_FLAG;
+    template <typename T> const size_t Circuit<T>::NO_INPUT;
+
+}
@@ -0,0 +1,610 @@
+// -----------------------------------------------------------
+// CompressedBitmap and BitmapSink classes
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// compressed sets of row indices to keep the results of
+// expressions for huge numbers of vectors. the rows are split
+// into chunks of 65536 by their upper bits, each chunk is
+// stored in the smallest of three containers (roaring bitmap
+// layout):
+//   array    sorted lower 16 bits, up to 4096 rows
+//   bitmap   65536 bits, for dense chunks
+//   run      start/length pairs, for long stretches of rows
+// so both very sparse and very dense results stay small.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "LogicalExpression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace tc
+{
+    // -----------------------------------------------------------
+    // representation of a chunk of a compressed bitmap
+    // -----------------------------------------------------------
+    enum CONTAINER_TYPE
+    {
+        CONTAINER_ARRAY,
+        CONTAINER_BITMAP,
+        CONTAINER_RUN
+    };
+
+
+    class CompressedBitmap final
+    {
+    private:
+        // an array container is converted to a bitmap beyond that
+        static const std::uint32_t ARRAY_MAX = 4096;
+        static const size_t BITMAP_WORDS = 1024;
+
+        enum SET_OPERATION
+        {
+            SET_AND,
+            SET_OR,
+            SET_AND_NOT,
+            SET_XOR
+        };
+
+        // the rows start to start + length
+        struct Run
+        {
+            std::uint16_t start;
+            std::uint16_t length;
+        };
+
+        // -----------------------------------------------------------
+        // the rows whose upper bits equal key, only the vector that
+        // belongs to the type is in use
+        // -----------------------------------------------------------
+        struct Container
+        {
+            std::uint64_t key;
+            CONTAINER_TYPE type;
+            std::uint32_t cardinality;
+            std::vector<std::uint16_t> values;
+            std::vector<std::uint64_t> words;
+            std::vector<Run> runs;
+        };
+
+        // sorted by key, never holds an empty container
+        std::vector<Container> m_containers;
+
+    public:
+        CompressedBitmap() {}
+        ~CompressedBitmap() {}
+
+        // -----------------------------------------------------------
+        // insert a row, ascending rows are appended in constant time
+        // -----------------------------------------------------------
+        void add(std::uint64_t row)
+        {
+            const std::uint64_t key = row >> 16;
+            const std::uint16_t low = static_cast<std::uint16_t>(row & 0xFFFF);
+
+            if (m_containers.empty() || m_containers.back().key < key)
+            {
+                // rows mostly arrive in ascending order, so the last
+                // container is complete and can be compacted
+                if (!m_containers.empty())
+                    optimizeContainer(m_containers.back());
+                m_containers.push_back(makeContainer(key));
+                addToContainer(m_containers.back(), low);
+                return;
+            }
+
+            auto it = findContainer(key);
+            if (it == m_containers.end() || it->key != key)
+                it = m_containers.insert(it, makeContainer(key));
+            addToContainer(*it, low);
+        }
+
+        bool contains(std::uint64_t row) const
+        {
+            const std::uint64_t key = row >> 16;
+            auto it = std::lower_bound(m_containers.begin(), m_containers.end(), key,
+                [](const Container &c, std::uint64_t k) { return c.key < k; });
+
+            return it != m_containers.end() && it->key == key &&
+                containerContains(*it, static_cast<std::uint16_t>(row & 0xFFFF));
+        }
+
+        std::uint64_t cardinality() const
+        {
+            std::uint64_t n = 0;
+            for (auto & c : m_containers)
+                n += c.cardinality;
+
+            return n;
+        }
+
+        bool empty() const { return m_containers.empty(); }
+
+        void clear() { m_containers.clear(); }
+
+        // -----------------------------------------------------------
+        // convert every container into its smallest representation
+        // -----------------------------------------------------------
+        void optimize()
+        {
+            for (auto & c : m_containers)
+                optimizeContainer(c);
+        }
+
+        // memory used by the bitmap
+        size_t sizeInBytes() const
+        {
+            size_t n = sizeof(*this) + m_containers.capacity() * sizeof(Container);
+            for (auto & c : m_containers)
+                n += c.values.capacity() * sizeof(std::uint16_t) + c.words.capacity() * sizeof(std::uint64_t) +
+                    c.runs.capacity() * sizeof(Run);
+
+            return n;
+        }
+
+        // -----------------------------------------------------------
+        // call f for every row in ascending order
+        // -----------------------------------------------------------
+        template <typename F>
+        void forEach(F f) const
+        {
+            for (auto & c : m_containers)
+            {
+                const std::uint64_t base = c.key << 16;
+                forEachInContainer(c, [&f, base](std::uint32_t low) { f(base | low); });
+            }
+        }
+
+        std::vector<std::uint64_t> rows() const
+        {
+            std::vector<std::uint64_t> rowVec;
+            rowVec.reserve(static_cast<size_t>(cardinality()));
+            forEach([&rowVec](std::uint64_t row) { rowVec.push_back(row); });
+
+            return rowVec;
+        }
+
+        // -----------------------------------------------------------
+        // set operations, - is the difference
+        // -----------------------------------------------------------
+        CompressedBitmap& operator&=(const CompressedBitmap &rhs)
+        {
+            *this = combine(*this, rhs, SET_AND);
+            return *this;
+        }
+
+        CompressedBitmap& operator|=(const CompressedBitmap &rhs)
+        {
+            *this = combine(*this, rhs, SET_OR);
+            return *this;
+        }
+
+        CompressedBitmap& operator-=(const CompressedBitmap &rhs)
+        {
+            *this = combine(*this, rhs, SET_AND_NOT);
+            return *this;
+        }
+
+        CompressedBitmap& operator^=(const CompressedBitmap &rhs)
+        {
+            *this = combine(*this, rhs, SET_XOR);
+            return *this;
+        }
+
+        friend CompressedBitmap operator&(const CompressedBitmap &a, const CompressedBitmap &b)
+        {
+            return combine(a, b, SET_AND);
+        }
+
+        friend CompressedBitmap operator|(const CompressedBitmap &a, const CompressedBitmap &b)
+        {
+            return combine(a, b, SET_OR);
+        }
+
+        friend CompressedBitmap operator-(const CompressedBitmap &a, const CompressedBitmap &b)
+        {
+            return combine(a, b, SET_AND_NOT);
+        }
+
+        friend CompressedBitmap operator^(const CompressedBitmap &a, const CompressedBitmap &b)
+        {
+            return combine(a, b, SET_XOR);
+        }
+
+        // equal sets, independent of the representation
+        friend bool operator==(const CompressedBitmap &a, const CompressedBitmap &b)
+        {
+            return a.cardinality() == b.cardinality() && combine(a, b, SET_XOR).empty();
+        }
+
+        friend bool operator!=(const CompressedBitmap &a, const CompressedBitmap &b)
+        {
+            return !(a == b);
+        }
+
+    private:
+        static unsigned popCount(std::uint64_t w)
+        {
+            w = w - ((w >> 1) & 0x5555555555555555ULL);
+            w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+            w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+            return static_cast<unsigned>((w * 0x0101010101010101ULL) >> 56);
+        }
+
+        static Container makeContainer(std::uint64_t key)
+        {
+            Container c;
+            c.key = key;
+            c.type = CONTAINER_ARRAY;
+            c.cardinality = 0;
+
+            return c;
+        }
+
+        std::vector<Container>::iterator findContainer(std::uint64_t key)
+        {
+            return std::lower_bound(m_containers.begin(), m_containers.end(), key,
+                [](const Container &c, std::uint64_t k) { return c.key < k; });
+        }
+
+        template <typename F>
+        static void forEachInContainer(const Container &c, F f)
+        {
+            switch (c.type)
+            {
+            case CONTAINER_ARRAY:
+                for (auto v : c.values)
+                    f(v);
+                break;
+            case CONTAINER_BITMAP:
+                for (size_t w = 0; w < c.words.size(); ++w)
+                {
+                    for (std::uint64_t word = c.words[w]; word; )
+                    {
+                        const std::uint64_t lowest = word & (~word + 1);
+                        f(static_cast<std::uint32_t>(w * 64 + popCount(lowest - 1)));
+                        word ^= lowest;
+                    }
+                }
+                break;
+            case CONTAINER_RUN:
+                for (auto & run : c.runs)
+                    for (std::uint32_t v = run.start; v <= std::uint32_t(run.start) + run.length; ++v)
+                        f(v);
+                break;
+            }
+        }
+
+        static bool containerContains(const Container &c, std::uint16_t low)
+        {
+            switch (c.type)
+            {
+            case CONTAINER_ARRAY:
+                return std::binary_search(c.values.begin(), c.values.end(), low);
+            case CONTAINER_BITMAP:
+                return (c.words[low >> 6] >> (low & 63)) & 1;
+            case CONTAINER_RUN:
+            {
+                // the last run starting at or before low
+                auto it = std::upper_bound(c.runs.begin(), c.runs.end(), low,
+                    [](std::uint16_t v, const Run &run) { return v < run.start; });
+                if (it == c.runs.begin())
+                    return false;
+                --it;
+                return low - it->start <= it->length;
+            }
+            }
+
+            return false;
+        }
+
+        static void addToContainer(Container &c, std::uint16_t low)
+        {
+            if (c.type == CONTAINER_RUN)
+                toBitmap(c);
+
+            if (c.type == CONTAINER_ARRAY)
+            {
+                if (c.values.empty() || c.values.back() < low)
+                    c.values.push_back(low);
+                else
+                {
+                    auto it = std::lower_bound(c.values.begin(), c.values.end(), low);
+                    if (*it == low)
+                        return;
+                    c.values.insert(it, low);
+                }
+
+                if (++c.cardinality > ARRAY_MAX)
+                    toBitmap(c);
+            }
+            else
+            {
+                std::uint64_t &word = c.words[low >> 6];
+                const std::uint64_t bit = std::uint64_t(1) << (low & 63);
+                if (!(word & bit))
+                {
+                    word |= bit;
+                    ++c.cardinality;
+                }
+            }
+        }
+
+        // -----------------------------------------------------------
+        // conversions between the container types
+        // -----------------------------------------------------------
+        static void toBitmap(Container &c)
+        {
+            if (c.type == CONTAINER_BITMAP)
+                return;
+
+            std::vector<std::uint64_t> words(BITMAP_WORDS, 0);
+            forEachInContainer(c, [&words](std::uint32_t v) { words[v >> 6] |= std::uint64_t(1) << (v & 63); });
+            c.words.swap(words);
+            std::vector<std::uint16_t>().swap(c.values);
+            std::vector<Run>().swap(c.runs);
+            c.type = CONTAINER_BITMAP;
+        }
+
+        static void toArray(Container &c)
+        {
+            if (c.type == CONTAINER_ARRAY)
+                return;
+
+            std::vector<std::uint16_t> values;
+            values.reserve(c.cardinality);
+            forEachInContainer(c, [&values](std::uint32_t v) { values.push_back(static_cast<std::uint16_t>(v)); });
+            c.values.swap(values);
+            std::vector<std::uint64_t>().swap(c.words);
+            std::vector<Run>().swap(c.runs);
+            c.type = CONTAINER_ARRAY;
+        }
+
+        static void toRuns(Container &c, size_t numRuns)
+        {
+            if (c.type == CONTAINER_RUN)
+                return;
+
+            std::vector<Run> runs;
+            runs.reserve(numRuns);
+            forEachInContainer(c, [&runs](std::uint32_t v) {
+                if (!runs.empty() && std::uint32_t(runs.back().start) + runs.back().length + 1 == v)
+                    ++runs.back().length;
+                else
+                {
+                    Run run = { static_cast<std::uint16_t>(v), 0 };
+                    runs.push_back(run);
+                }
+            });
+            c.runs.swap(runs);
+            std::vector<std::uint16_t>().swap(c.values);
+            std::vector<std::uint64_t>().swap(c.words);
+            c.type = CONTAINER_RUN;
+        }
+
+        static size_t countRuns(const Container &c)
+        {
+            size_t numRuns = 0;
+            switch (c.type)
+            {
+            case CONTAINER_ARRAY:
+                for (size_t i = 0; i < c.values.size(); ++i)
+                    if (i == 0 || c.values[i] != c.values[i - 1] + 1)
+                        ++numRuns;
+                break;
+            case CONTAINER_BITMAP:
+            {
+                // a run starts at every set bit whose predecessor is not set
+                std::uint64_t carry = 0;
+                for (auto word : c.words)
+                {
+                    numRuns += popCount(word & ~((word << 1) | carry));
+                    carry = word >> 63;
+                }
+                break;
+            }
+            case CONTAINER_RUN:
+                numRuns = c.runs.size();
+                break;
+            }
+
+            return numRuns;
+        }
+
+        // -----------------------------------------------------------
+        // choose the representation with the fewest bytes
+        // -----------------------------------------------------------
+        static void optimizeContainer(Container &c)
+        {
+            const size_t numRuns = countRuns(c);
+            const size_t runBytes = 2 + numRuns * sizeof(Run);
+            const size_t bitmapBytes = BITMAP_WORDS * sizeof(std::uint64_t);
+            const size_t arrayBytes = c.cardinality <= ARRAY_MAX ? c.cardinality * sizeof(std::uint16_t) : bitmapBytes;
+
+            if (runBytes < arrayBytes && runBytes < bitmapBytes)
+                toRuns(c, numRuns);
+            else if (c.cardinality <= ARRAY_MAX)
+                toArray(c);
+            else
+                toBitmap(c);
+
+            c.values.shrink_to_fit();
+            c.runs.shrink_to_fit();
+        }
+
+        // the bits of a container, whatever its type
+        static std::vector<std::uint64_t> containerWords(const Container &c)
+        {
+            if (c.type == CONTAINER_BITMAP)
+                return c.words;
+
+            Container copy = c;
+            toBitmap(copy);
+
+            return std::move(copy.words);
+        }
+
+        static Container combine(const Container &a, const Container &b, SET_OPERATION op)
+        {
+            Container c = makeContainer(a.key);
+
+            if (a.type == CONTAINER_ARRAY && b.type == CONTAINER_ARRAY)
+            {
+                auto out = std::back_inserter(c.values);
+                switch (op)
+                {
+                case SET_AND: std::set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), out); break;
+                case SET_OR: std::set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), out); break;
+                case SET_AND_NOT: std::set_difference(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), out); break;
+                case SET_XOR: std::set_symmetric_difference(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), out); break;
+                }
+                c.cardinality = static_cast<std::uint32_t>(c.values.size());
+            }
+            else if ((op == SET_AND || op == SET_AND_NOT) && a.type == CONTAINER_ARRAY)
+            {
+                // the result is a subset of the small array
+                const bool keep = op == SET_AND;
+                for (auto v : a.values)
+                    if (containerContains(b, v) == keep)
+                        c.values.push_back(v);
+                c.cardinality = static_cast<std::uint32_t>(c.values.size());
+            }
+            else if (op == SET_AND && b.type == CONTAINER_ARRAY)
+            {
+                for (auto v : b.values)
+                    if (containerContains(a, v))
+                        c.values.push_back(v);
+                c.cardinality = static_cast<std::uint32_t>(c.values.size());
+            }
+            else
+            {
+                c.words = containerWords(a);
+                const std::vector<std::uint64_t> bWords = containerWords(b);
+                for (size_t w = 0; w < BITMAP_WORDS; ++w)
+                {
+                    switch (op)
+                    {
+                    case SET_AND: c.words[w] &= bWords[w]; break;
+                    case SET_OR: c.words[w] |= bWords[w]; break;
+                    case SET_AND_NOT: c.words[w] &= ~bWords[w]; break;
+                    case SET_XOR: c.words[w] ^= bWords[w]; break;
+                    }
+                    c.cardinality += popCount(c.words[w]);
+                }
+                c.type = CONTAINER_BITMAP;
+            }
+
+            if (c.cardinality)
+                optimizeContainer(c);
+
+            return c;
+        }
+
+        static CompressedBitmap combine(const CompressedBitmap &a, const CompressedBitmap &b, SET_OPERATION op)
+        {
+            // containers only present in one operand are kept as they are
+            // if the operation keeps them at all
+            const bool keepA = op != SET_AND;
+            const bool keepB = op == SET_OR || op == SET_XOR;
+
+            CompressedBitmap result;
+            auto ia = a.m_containers.begin();
+            auto ib = b.m_containers.begin();
+            while (ia != a.m_containers.end() || ib != b.m_containers.end())
+            {
+                if (ib == b.m_containers.end() || (ia != a.m_containers.end() && ia->key < ib->key))
+                {
+                    if (keepA)
+                        result.m_containers.push_back(*ia);
+                    ++ia;
+                }
+                else if (ia == a.m_containers.end() || ib->key < ia->key)
+                {
+                    if (keepB)
+                        result.m_containers.push_back(*ib);
+                    ++ib;
+                }
+                else
+                {
+                    Container c = combine(*ia, *ib, op);
+                    if (c.cardinality)
+                        result.m_containers.push_back(std::move(c));
+                    ++ia;
+                    ++ib;
+                }
+            }
+
+            return result;
+        }
+    };
+
+
+    // -----------------------------------------------------------
+    // collects the results of a StreamEvaluator into one bitmap
+    // per expression. pass it as std::ref(sink), it cannot be
+    // copied so a sink passed by value does not compile
+    // -----------------------------------------------------------
+    class BitmapSink final
+    {
+    private:
+        std::vector<CompressedBitmap> m_bitmaps;
+
+    public:
+        explicit BitmapSink(size_t numExpressions) : m_bitmaps(numExpressions) {}
+        ~BitmapSink() {}
+
+        void operator()(size_t firstRow, const std::vector<std::vector<bool>> &evalVec)
+        {
+            for (size_t r = 0; r < evalVec.size(); ++r)
+                for (size_t e = 0; e < m_bitmaps.size() && e < evalVec[r].size(); ++e)
+                    if (evalVec[r][e])
+                        m_bitmaps[e].add(firstRow + r);
+        }
+
+        // -----------------------------------------------------------
+        // the compacted bitmaps, leaves the sink empty
+        // -----------------------------------------------------------
+        std::vector<CompressedBitmap> finish()
+        {
+            for (auto & bitmap : m_bitmaps)
+                bitmap.optimize();
+
+            std::vector<CompressedBitmap> bitmaps(m_bitmaps.size());
+            bitmaps.swap(m_bitmaps);
+
+            return bitmaps;
+        }
+
+    private:
+        BitmapSink() = delete;
+        BitmapSink(const BitmapSink&) = delete;
+        BitmapSink& operator=(const BitmapSink&) = delete;
+    };
+
+
+    // -----------------------------------------------------------
+    // evaluate a bunch of expressions for various vectors at once,
+    // one bitmap of matching rows per expression
+    // -----------------------------------------------------------
+    template <typename T>
+    std::vector<CompressedBitmap> evaluateCompressed(const std::vector<std::vector<T>> &valuesVec,
+        const std::vector<LogicalExpression<T>> &expressions)
+    {
+        std::vector<CompressedBitmap> bitmaps(expressions.size());
+        for (size_t r = 0; r < valuesVec.size(); ++r)
+            for (size_t e = 0; e < expressions.size(); ++e)
+                if (expressions[e].evaluate(valuesVec[r]))
+                    bitmaps[e].add(r);
+
+        for (auto & bitmap : bitmaps)
+            bitmap.optimize();
+
+        return bitmaps;
+    }
+
+}
@@ -0,0 +1,87 @@
+// -----------------------------------------------------------
+// ExpressionSetBuilder class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// collects a large number of logical expressions (e.g. rules
+// generated from a configuration) and freezes them into an
+// immutable expression set that can be shared between
+// evaluators without copying.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "LogicalExpression.h"
+
+#include <memory>
+#include <vector>
+#include <iterator>
+
+namespace tc
+{
+    // -----------------------------------------------------------
+    // an immutable, shareable set of logical expressions
+    // -----------------------------------------------------------
+    template <typename T>
+    using ExpressionSet = std::shared_ptr<const std::vector<LogicalExpression<T>>>;
+
+
+    // -----------------------------------------------------------
+    // builder for expression sets
+    // expressions handed in as rvalues are moved all the way into
+    // the set, so no reference counts are touched while building.
+    // only terms that are really shared (lvalues used in several
+    // rules) cost a reference count increment.
+    // -----------------------------------------------------------
+    template <typename T>
+    class ExpressionSetBuilder final
+    {
+    private:
+        std::vector<LogicalExpression<T>> m_expressions;
+
+    public:
+        ExpressionSetBuilder() {}
+        explicit ExpressionSetBuilder(size_t capacity) { m_expressions.reserve(capacity); }
+        ~ExpressionSetBuilder() {}
+
+        void reserve(size_t capacity)
+        {
+            m_expressions.reserve(capacity);
+        }
+
+        size_t size() const
+        {
+            return m_expressions.size();
+        }
+
+        ExpressionSetBuilder<T>& add(LogicalExpression<T> expression)
+        {
+            m_expressions.push_back(std::move(expression));
+            return *this;
+        }
+
+        template <typename InputIt>
+        ExpressionSetBuilder<T>& add(InputIt first, InputIt last)
+        {
+            m_expressions.insert(m_expressions.end(), first, last);
+            return *this;
+        }
+
+        ExpressionSetBuilder<T>& operator<<(LogicalExpression<T> expression)
+        {
+            return add(std::move(expression));
+        }
+
+        // -----------------------------------------------------------
+        // hand the collected expressions over to an immutable set,
+        // the builder is empty afterwards and can be reused
+        // -----------------------------------------------------------
+        ExpressionSet<T> freeze()
+        {
+            ExpressionSet<T> expressionSet = std::make_shared<const std::vector<LogicalExpression<T>>>(std::move(m_expressions));
+            m_expressions = std::vector<LogicalExpression<T>>();
+            return expressionSet;
+        }
+    };
+
+}
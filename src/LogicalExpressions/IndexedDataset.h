@@ -0,0 +1,289 @@
+// -----------------------------------------------------------
+// IndexedDataset class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// a fixed set of vectors with a sorted index per variable and
+// per registered term. comparisons of an indexed variable or
+// term with a constant are answered by binary search, their
+// row sets are combined following the &&, ||, ==, != and !
+// structure of the expression. everything else is evaluated
+// by scanning the rows that can still change the result.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "Inspection.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace tc
+{
+
+    template <typename T>
+    class IndexedDataset final
+    {
+    private:
+        // one bit per row
+        typedef std::vector<std::uint64_t> Bits;
+
+        // -----------------------------------------------------------
+        // the values of a column in ascending order together with
+        // the rows they belong to, NaNs are left out as they
+        // compare false with everything
+        // -----------------------------------------------------------
+        struct SortedColumn
+        {
+            std::vector<T> values;
+            std::vector<size_t> rows;
+        };
+
+        std::vector<std::vector<T>> m_valuesVec;
+        std::vector<SortedColumn> m_variableColumns;
+        std::map<const TermBehavior<T>*, SortedColumn> m_termColumns;
+        // keeps registered terms alive, so their keys stay unique
+        std::vector<Term<T>> m_terms;
+
+    public:
+        // -----------------------------------------------------------
+        // indexes every variable that is present in all vectors
+        // -----------------------------------------------------------
+        explicit IndexedDataset(std::vector<std::vector<T>> valuesVec) :
+            m_valuesVec(std::move(valuesVec))
+        {
+            size_t numVars = m_valuesVec.empty() ? 0 : m_valuesVec.front().size();
+            for (auto & values : m_valuesVec)
+                numVars = std::min(numVars, values.size());
+
+            m_variableColumns.reserve(numVars);
+            for (size_t idx = 0; idx < numVars; ++idx)
+            {
+                std::vector<T> column;
+                column.reserve(m_valuesVec.size());
+                for (auto & values : m_valuesVec)
+                    column.push_back(values[idx]);
+                m_variableColumns.push_back(sortColumn(column));
+            }
+        }
+        ~IndexedDataset() {}
+
+        size_t size() const { return m_valuesVec.size(); }
+
+        // -----------------------------------------------------------
+        // index a derived term (e.g. the center of gravity), every
+        // comparison of this very term object with a constant is
+        // answered by the index afterwards
+        // -----------------------------------------------------------
+        void registerTerm(const Term<T> &term)
+        {
+            const TermBehavior<T> *tb = Inspection<T>::behavior(term).get();
+            if (m_termColumns.count(tb))
+                return;
+
+            m_termColumns[tb] = sortColumn(term.substitute(m_valuesVec));
+            m_terms.push_back(term);
+        }
+
+        // -----------------------------------------------------------
+        // evaluate an expression for all vectors of the dataset
+        // -----------------------------------------------------------
+        std::vector<bool> evaluate(const LogicalExpression<T> &expression) const
+        {
+            Bits matches = query(Inspection<T>::behavior(expression), allRows());
+
+            std::vector<bool> evalVec(m_valuesVec.size());
+            for (size_t r = 0; r < evalVec.size(); ++r)
+                evalVec[r] = (matches[r >> 6] >> (r & 63)) & 1;
+
+            return evalVec;
+        }
+
+        // number of vectors an expression holds for
+        size_t count(const LogicalExpression<T> &expression) const
+        {
+            Bits matches = query(Inspection<T>::behavior(expression), allRows());
+
+            size_t n = 0;
+            for (auto word : matches)
+                for (; word; word &= word - 1)
+                    ++n;
+
+            return n;
+        }
+
+    private:
+        IndexedDataset() = delete;
+
+        SortedColumn sortColumn(const std::vector<T> &column) const
+        {
+            std::vector<size_t> order;
+            order.reserve(column.size());
+            for (size_t r = 0; r < column.size(); ++r)
+                if (column[r] == column[r])
+                    order.push_back(r);
+            std::sort(order.begin(), order.end(), [&column](size_t a, size_t b) { return column[a] < column[b]; });
+
+            SortedColumn sorted;
+            sorted.values.reserve(order.size());
+            for (auto r : order)
+                sorted.values.push_back(column[r]);
+            sorted.rows = std::move(order);
+
+            return sorted;
+        }
+
+        Bits allRows() const
+        {
+            const size_t n = m_valuesVec.size();
+            Bits bits((n + 63) / 64, ~std::uint64_t(0));
+            if (n & 63)
+                bits.back() = (std::uint64_t(1) << (n & 63)) - 1;
+
+            return bits;
+        }
+
+        // -----------------------------------------------------------
+        // rows within mask of a sorted column that satisfy a
+        // comparison
+        // -----------------------------------------------------------
+        Bits lookup(const SortedColumn &column, COMPARISON cmp, T val, const Bits &mask) const
+        {
+            if (val != val)
+                return cmp == CMP_NOT_EQUAL ? mask : Bits(mask.size(), 0);
+
+            Bits bits(mask.size(), 0);
+            auto first = column.values.begin();
+            auto last = column.values.end();
+            size_t lower = std::lower_bound(first, last, val) - first;
+            size_t upper = std::upper_bound(first, last, val) - first;
+
+            size_t begin = 0, end = 0;
+            switch (cmp)
+            {
+            case CMP_LESS: end = lower; break;
+            case CMP_LESS_EQUAL: end = upper; break;
+            case CMP_GREATER: begin = upper; end = column.values.size(); break;
+            case CMP_GREATER_EQUAL: begin = lower; end = column.values.size(); break;
+            case CMP_EQUAL:
+            case CMP_NOT_EQUAL: begin = lower; end = upper; break;
+            default: break;
+            }
+
+            for (size_t i = begin; i < end; ++i)
+                bits[column.rows[i] >> 6] |= std::uint64_t(1) << (column.rows[i] & 63);
+
+            // the mask has no bits beyond the last row
+            if (cmp == CMP_NOT_EQUAL)
+            {
+                for (size_t w = 0; w < bits.size(); ++w)
+                    bits[w] = ~bits[w] & mask[w];
+            }
+            else
+            {
+                for (size_t w = 0; w < bits.size(); ++w)
+                    bits[w] &= mask[w];
+            }
+
+            return bits;
+        }
+
+        // -----------------------------------------------------------
+        // the rows within mask an expression holds for, rows outside
+        // the mask do not matter to the caller and are never set
+        // -----------------------------------------------------------
+        Bits query(const std::shared_ptr<LogicalExpressionBehavior<T>> &leb, const Bits &mask) const
+        {
+            const ExpressionNode<T> node = Inspection<T>::node(*leb);
+            if (node.kind == EXPR_COMBINED)
+            {
+                if (node.connective == LOGIC_AND)
+                {
+                    // the second operand only matters where the first holds
+                    Bits a = query(*node.operands[0], mask);
+                    Bits b = query(*node.operands[1], a);
+                    for (size_t w = 0; w < a.size(); ++w)
+                        a[w] &= b[w];
+                    return a;
+                }
+                if (node.connective == LOGIC_OR)
+                {
+                    // the second operand only matters where the first fails
+                    Bits a = query(*node.operands[0], mask);
+                    Bits rest(mask.size());
+                    for (size_t w = 0; w < a.size(); ++w)
+                        rest[w] = mask[w] & ~a[w];
+                    Bits b = query(*node.operands[1], rest);
+                    for (size_t w = 0; w < a.size(); ++w)
+                        a[w] |= b[w];
+                    return a;
+                }
+                if (node.connective == LOGIC_EQUAL || node.connective == LOGIC_NOT_EQUAL)
+                {
+                    Bits a = query(*node.operands[0], mask);
+                    Bits b = query(*node.operands[1], mask);
+                    const bool equal = node.connective == LOGIC_EQUAL;
+                    for (size_t w = 0; w < a.size(); ++w)
+                        a[w] = (equal ? ~(a[w] ^ b[w]) : (a[w] ^ b[w])) & mask[w];
+                    return a;
+                }
+            }
+            else if (node.kind == EXPR_MODIFIED)
+            {
+                if (node.connective == LOGIC_NOT)
+                {
+                    Bits a = query(*node.operands[0], mask);
+                    for (size_t w = 0; w < a.size(); ++w)
+                        a[w] = ~a[w] & mask[w];
+                    return a;
+                }
+            }
+            else if (node.kind == EXPR_TERM)
+            {
+                if (const SortedColumn *column = findColumn(*node.terms[0]))
+                {
+                    if (node.comparison != CMP_CUSTOM)
+                        return lookup(*column, node.comparison, node.value, mask);
+                }
+            }
+
+            return scan(*leb, mask);
+        }
+
+        // -----------------------------------------------------------
+        // fallback for opaque parts: evaluate the rows within mask
+        // -----------------------------------------------------------
+        Bits scan(const LogicalExpressionBehavior<T> &leb, const Bits &mask) const
+        {
+            Bits bits(mask.size(), 0);
+            for (size_t w = 0; w < mask.size(); ++w)
+            {
+                if (!mask[w])
+                    continue;
+                for (size_t bit = 0; bit < 64; ++bit)
+                    if (((mask[w] >> bit) & 1) && Inspection<T>::evaluate(leb, m_valuesVec[w * 64 + bit]))
+                        bits[w] |= std::uint64_t(1) << bit;
+            }
+
+            return bits;
+        }
+
+        const SortedColumn* findColumn(const Term<T> &term) const
+        {
+            const TermBehavior<T> &tb = *Inspection<T>::behavior(term);
+            auto it = m_termColumns.find(&tb);
+            if (it != m_termColumns.end())
+                return &it->second;
+
+            const TermNode<T> node = Inspection<T>::node(tb);
+            if (node.kind == TERM_VARIABLE && node.index < m_variableColumns.size())
+                return &m_variableColumns[node.index];
+
+            return nullptr;
+        }
+    };
+
+}
@@ -0,0 +1,61 @@
+// -----------------------------------------------------------
+// Inspection class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// read access to the structure of terms and logical
+// expressions for the code that compiles or indexes them
+// (RuleSet, Plan, IndexedDataset). the nodes describe
+// themselves as TermNode or ExpressionNode, terms, expressions
+// and behaviors only grant access to this class.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "LogicalExpression.h"
+
+#include <memory>
+#include <vector>
+
+namespace tc
+{
+
+    template <typename T>
+    class Inspection final
+    {
+    public:
+        static const std::shared_ptr<TermBehavior<T>>& behavior(const Term<T> &term)
+        {
+            return term.m_termBehavior;
+        }
+
+        static const std::shared_ptr<LogicalExpressionBehavior<T>>& behavior(const LogicalExpression<T> &expression)
+        {
+            return expression.m_leBehavior;
+        }
+
+        static TermNode<T> node(const TermBehavior<T> &tb)
+        {
+            TermNode<T> node = { TERM_CONST, OP_CUSTOM, 0, T(), nullptr, nullptr, { nullptr, nullptr } };
+            tb.describe(node);
+            return node;
+        }
+
+        static ExpressionNode<T> node(const LogicalExpressionBehavior<T> &leb)
+        {
+            ExpressionNode<T> node = { EXPR_TERM, CMP_CUSTOM, LOGIC_CUSTOM, T(), { nullptr, nullptr },
+                nullptr, nullptr, nullptr, nullptr, { nullptr, nullptr } };
+            leb.describe(node);
+            return node;
+        }
+
+        static bool evaluate(const LogicalExpressionBehavior<T> &leb, const std::vector<T> &values)
+        {
+            return leb.evaluate(values);
+        }
+
+    private:
+        Inspection() = delete;
+    };
+
+}
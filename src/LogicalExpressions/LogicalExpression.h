@@ -11,6 +11,8 @@
 
 #include "LogicalExpressionBehavior.h"
 
+#include <algorithm>
+
 namespace tc
 {
 
@@ -22,13 +24,34 @@ namespace tc
 
     public:
         LogicalExpression(Term<T> la1, Term<T> la2, std::function<bool(T, T)> f) :
-            m_leBehavior(std::shared_ptr<CombinedTermExpressionBehavior<T>>(new CombinedTermExpressionBehavior<T>(la1, la2, f))) {}
+            m_leBehavior(std::make_shared<CombinedTermExpressionBehavior<T>>(BehaviorKey<T>(), std::move(la1), std::move(la2), std::move(f))) {}
         LogicalExpression(Term<T> la, std::function<bool(T)> f) :
-            m_leBehavior(std::shared_ptr<SingleTermExpressionBehavior<T>>(new SingleTermExpressionBehavior<T>(la, f))) {}
+            m_leBehavior(std::make_shared<SingleTermExpressionBehavior<T>>(BehaviorKey<T>(), std::move(la), std::move(f))) {}
         LogicalExpression(LogicalExpression<T> le, std::function<bool(bool)> f) :
-            m_leBehavior(std::shared_ptr<ModifiedExpressionBehavior<T>>(new ModifiedExpressionBehavior<T>(le.getBehavior(), f))) {}
+            m_leBehavior(std::make_shared<ModifiedExpressionBehavior<T>>(BehaviorKey<T>(), std::move(le.m_leBehavior), std::move(f))) {}
         LogicalExpression(LogicalExpression<T> le1, LogicalExpression<T> le2, std::function<bool(bool, bool)> f) :
-            m_leBehavior(std::shared_ptr<CombinedExpressionBehavior<T>>(new CombinedExpressionBehavior<T>(le1.getBehavior(), le2.getBehavior(), f))) {}
+            m_leBehavior(std::make_shared<CombinedExpressionBehavior<T>>(BehaviorKey<T>(), std::move(le1.m_leBehavior), std::move(le2.m_leBehavior), std::move(f))) {}
+        LogicalExpression(Term<T> la1, COMPARISON cmp, Term<T> la2) :
+            m_leBehavior(std::make_shared<CombinedTermExpressionBehavior<T>>(BehaviorKey<T>(), std::move(la1), std::move(la2), makeComparer<T>(cmp), cmp)) {}
+        LogicalExpression(Term<T> la, COMPARISON cmp, T val) :
+            m_leBehavior(std::make_shared<SingleTermExpressionBehavior<T>>(BehaviorKey<T>(), std::move(la), makeComparer<T>(cmp, val), cmp, val)) {}
+        LogicalExpression(LogicalExpression<T> le, CONNECTIVE con) :
+            m_leBehavior(std::make_shared<ModifiedExpressionBehavior<T>>(BehaviorKey<T>(), std::move(le.m_leBehavior), makeModifier(con), con)) {}
+        LogicalExpression(LogicalExpression<T> le1, CONNECTIVE con, LogicalExpression<T> le2) :
+            m_leBehavior(std::make_shared<CombinedExpressionBehavior<T>>(BehaviorKey<T>(), std::move(le1.m_leBehavior), std::move(le2.m_leBehavior), makeCombiner(con), con)) {}
+        // see Term, keep the move operations despite the destructor
+        LogicalExpression(const LogicalExpression<T> &other) : m_leBehavior(other.m_leBehavior) {}
+        LogicalExpression(LogicalExpression<T> &&other) : m_leBehavior(std::move(other.m_leBehavior)) {}
+        LogicalExpression<T>& operator=(const LogicalExpression<T> &other)
+        {
+            m_leBehavior = other.m_leBehavior;
+            return *this;
+        }
+        LogicalExpression<T>& operator=(LogicalExpression<T> &&other)
+        {
+            m_leBehavior = std::move(other.m_leBehavior);
+            return *this;
+        }
         ~LogicalExpression() {}
 
         bool evaluate(const std::vector<T> &values) const
@@ -45,9 +68,24 @@ namespace tc
             return evalVec;
         }
 
+        // -----------------------------------------------------------
+        // sorted indices of all variables the expression depends on
+        // -----------------------------------------------------------
+        std::vector<size_t> variables() const
+        {
+            std::vector<size_t> indices;
+            m_leBehavior->collectVariables(indices);
+            std::sort(indices.begin(), indices.end());
+            indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+            return indices;
+        }
+
     private:
+        friend class Inspection < T > ;
+
         LogicalExpression() = delete;
-        LogicalExpression(std::shared_ptr<LogicalExpressionBehavior<T>> leb) : m_leBehavior(leb) {}
+        LogicalExpression(std::shared_ptr<LogicalExpressionBehavior<T>> leb) : m_leBehavior(std::move(leb)) {}
         std::shared_ptr<LogicalExpressionBehavior<T>> getBehavior() const { return m_leBehavior; }
     };
 
@@ -93,39 +131,39 @@ namespace tc
     template <typename T>
     LogicalExpression<T> operator<(Term<T> a, Term<T> b)
     {
-        return LogicalExpression<T>(a, b, std::less<T>());
+        return LogicalExpression<T>(std::move(a), CMP_LESS, std::move(b));
     }
 
     template <typename T>
     LogicalExpression<T> operator<=(Term<T> a, Term<T> b)
     {
-        return LogicalExpression<T>(a, b, std::less_equal<T>());
+        return LogicalExpression<T>(std::move(a), CMP_LESS_EQUAL, std::move(b));
     }
 
     template <typename T>
     LogicalExpression<T> operator>(Term<T> a, Term<T> b)
     {
-        return LogicalExpression<T>(a, b, std::greater<T>());
+        return LogicalExpression<T>(std::move(a), CMP_GREATER, std::move(b));
     }
 
 
     template <typename T>
     LogicalExpression<T> operator>=(Term<T> a, Term<T> b)
     {
-        return LogicalExpression<T>(a, b, std::greater_equal<T>());
+        return LogicalExpression<T>(std::move(a), CMP_GREATER_EQUAL, std::move(b));
     }
 
 
     template <typename T>
     LogicalExpression<T> operator==(Term<T> a, Term<T> b)
     {
-        return LogicalExpression<T>(a, b, std::equal_to<T>());
+        return LogicalExpression<T>(std::move(a), CMP_EQUAL, std::move(b));
     }
 
     template <typename T>
     LogicalExpression<T> operator!=(Term<T> a, Term<T> b)
     {
-        return LogicalExpression<T>(a, b, std::not_equal_to<T>());
+        return LogicalExpression<T>(std::move(a), CMP_NOT_EQUAL, std::move(b));
     }
 
 
@@ -135,77 +173,77 @@ namespace tc
     template <typename T>
     LogicalExpression<T> operator<(Term<T> a, T val)
     {
-        return LogicalExpression<T>(a, [val](T a){ return a < val; });
+        return LogicalExpression<T>(std::move(a), CMP_LESS, val);
     }
 
     template <typename T>
     LogicalExpression<T> operator<=(Term<T> a, T val)
     {
-        return LogicalExpression<T>(a, [val](T a){ return a <= val; });
+        return LogicalExpression<T>(std::move(a), CMP_LESS_EQUAL, val);
     }
 
 
     template <typename T>
     LogicalExpression<T> operator>(Term<T> a, T val)
     {
-        return LogicalExpression<T>(a, [val](T a){ return a > val; });
+        return LogicalExpression<T>(std::move(a), CMP_GREATER, val);
     }
 
     template <typename T>
     LogicalExpression<T> operator>=(Term<T> a, T val)
     {
-        return LogicalExpression<T>(a, [val](T a){ return a >= val; });
+        return LogicalExpression<T>(std::move(a), CMP_GREATER_EQUAL, val);
     }
 
 
     template <typename T>
     LogicalExpression<T> operator==(Term<T> a, T val)
     {
-        return LogicalExpression<T>(a, [val](T a){ return a == val; });
+        return LogicalExpression<T>(std::move(a), CMP_EQUAL, val);
     }
 
     template <typename T>
     LogicalExpression<T> operator!=(Term<T> a, T val)
     {
-        return LogicalExpression<T>(a, [val](T a){ return a != val; });
+        return LogicalExpression<T>(std::move(a), CMP_NOT_EQUAL, val);
     }
 
     template <typename T>
     LogicalExpression<T> operator<(T val, Term<T> b)
     {
-        return LogicalExpression<T>(b, [val](T b){ return val < b; });
+        return LogicalExpression<T>(std::move(b), CMP_GREATER, val);
     }
 
     template <typename T>
     LogicalExpression<T> operator<=(T val, Term<T> b)
     {
-        return LogicalExpression<T>(b, [val](T b){ return val <= b; });
+        return LogicalExpression<T>(std::move(b), CMP_GREATER_EQUAL, val);
     }
 
 
     template <typename T>
     LogicalExpression<T> operator>(T val, Term<T> b)
     {
-        return LogicalExpression<T>(b, [val](T b){ return val > b; });
+        return LogicalExpression<T>(std::move(b), CMP_LESS, val);
     }
 
     template <typename T>
     LogicalExpression<T> operator>=(T val, Term<T> b)
     {
-        return LogicalExpression<T>(b, [val](T b){ return val >= b; });
+        return LogicalExpression<T>(std::move(b), CMP_LESS_EQUAL, val);
     }
 
 
     template <typename T>
     LogicalExpression<T> operator==(T val, Term<T> b)
     {
-        return LogicalExpression<T>(b, [val](T b){ return val == b; });
+        return LogicalExpression<T>(std::move(b), CMP_EQUAL, val);
     }
 
     template <typename T>
     LogicalExpression<T> operator!=(T val, Term<T> b)
     {
-        return LogicalExpression<T>(b, [val](T b){ return val != b; });
+        return LogicalExpression<T>(std::move(b), CMP_NOT_EQUAL, val);
     }
 
 
@@ -215,31 +253,31 @@ namespace tc
     template <typename T>
     LogicalExpression<T> operator&&(LogicalExpression<T> a, LogicalExpression<T> b)
     {
-        return LogicalExpression<T>(a, b, std::logical_and<bool>());
+        return LogicalExpression<T>(std::move(a), LOGIC_AND, std::move(b));
     }
 
     template <typename T>
     LogicalExpression<T> operator||(LogicalExpression<T> a, LogicalExpression<T> b)
     {
-        return LogicalExpression<T>(a, b, std::logical_or<bool>());
+        return LogicalExpression<T>(std::move(a), LOGIC_OR, std::move(b));
     }
 
     template <typename T>
     LogicalExpression<T> operator==(LogicalExpression<T> a, LogicalExpression<T> b)
     {
-        return LogicalExpression<T>(a, b, std::equal_to<bool>());
+        return LogicalExpression<T>(std::move(a), LOGIC_EQUAL, std::move(b));
     }
 
     template <typename T>
     LogicalExpression<T> operator!=(LogicalExpression<T> a, LogicalExpression<T> b)
     {
-        return LogicalExpression<T>(a, b, std::not_equal_to<bool>());
+        return LogicalExpression<T>(std::move(a), LOGIC_NOT_EQUAL, std::move(b));
     }
 
     template <typename T>
     LogicalExpression<T> operator!(LogicalExpression<T> a)
     {
-        return LogicalExpression<T>(a, std::logical_not<bool>());
+        return LogicalExpression<T>(std::move(a), LOGIC_NOT);
     }
 
 }
@@ -13,6 +13,8 @@
 
 #include <memory>
 #include <vector>
+#include <functional>
+#include <stdexcept>
 
 namespace tc
 {
@@ -22,6 +24,122 @@ namespace tc
     template <typename T> class ModifiedExpressionBehavior;
     template <typename T> class CombinedExpressionBehavior;
     template <typename T> class LogicalExpression;
+    template <typename T> class LogicalExpressionBehavior;
+
+
+    // -----------------------------------------------------------
+    // the kind of comparison an atomic expression performs,
+    // CMP_CUSTOM marks a user defined comparer
+    // -----------------------------------------------------------
+    enum COMPARISON
+    {
+        CMP_CUSTOM = 0,
+        CMP_LESS,
+        CMP_LESS_EQUAL,
+        CMP_GREATER,
+        CMP_GREATER_EQUAL,
+        CMP_EQUAL,
+        CMP_NOT_EQUAL
+    };
+
+    // -----------------------------------------------------------
+    // the kind of logical connective combining expressions,
+    // LOGIC_CUSTOM marks a user defined combiner or modifier
+    // -----------------------------------------------------------
+    enum CONNECTIVE
+    {
+        LOGIC_CUSTOM = 0,
+        LOGIC_AND,
+        LOGIC_OR,
+        LOGIC_EQUAL,
+        LOGIC_NOT_EQUAL,
+        LOGIC_NOT
+    };
+
+    // -----------------------------------------------------------
+    // comparers and combiners for the predefined kinds
+    // -----------------------------------------------------------
+    template <typename T>
+    std::function<bool(T, T)> makeComparer(COMPARISON cmp)
+    {
+        switch (cmp)
+        {
+        case CMP_LESS: return std::less<T>();
+        case CMP_LESS_EQUAL: return std::less_equal<T>();
+        case CMP_GREATER: return std::greater<T>();
+        case CMP_GREATER_EQUAL: return std::greater_equal<T>();
+        case CMP_EQUAL: return std::equal_to<T>();
+        case CMP_NOT_EQUAL: return std::not_equal_to<T>();
+        default: throw(std::invalid_argument("No predefined comparer for a custom comparison."));
+        }
+    }
+
+    template <typename T>
+    std::function<bool(T)> makeComparer(COMPARISON cmp, T val)
+    {
+        switch (cmp)
+        {
+        case CMP_LESS: return [val](T a){ return a < val; };
+        case CMP_LESS_EQUAL: return [val](T a){ return a <= val; };
+        case CMP_GREATER: return [val](T a){ return a > val; };
+        case CMP_GREATER_EQUAL: return [val](T a){ return a >= val; };
+        case CMP_EQUAL: return [val](T a){ return a == val; };
+        case CMP_NOT_EQUAL: return [val](T a){ return a != val; };
+        default: throw(std::invalid_argument("No predefined comparer for a custom comparison."));
+        }
+    }
+
+    inline std::function<bool(bool, bool)> makeCombiner(CONNECTIVE con)
+    {
+        switch (con)
+        {
+        case LOGIC_AND: return std::logical_and<bool>();
+        case LOGIC_OR: return std::logical_or<bool>();
+        case LOGIC_EQUAL: return std::equal_to<bool>();
+        case LOGIC_NOT_EQUAL: return std::not_equal_to<bool>();
+        default: throw(std::invalid_argument("No predefined combiner for this connective."));
+        }
+    }
+
+    inline std::function<bool(bool)> makeModifier(CONNECTIVE con)
+    {
+        if (con == LOGIC_NOT)
+            return std::logical_not<bool>();
+        throw(std::invalid_argument("No predefined modifier for this connective."));
+    }
+
+    // -----------------------------------------------------------
+    // the kinds of expression nodes: a term compared with a
+    // constant, two terms compared, a modified expression and two
+    // combined expressions
+    // -----------------------------------------------------------
+    enum EXPRESSION_NODE
+    {
+        EXPR_TERM,
+        EXPR_TERMS,
+        EXPR_MODIFIED,
+        EXPR_COMBINED
+    };
+
+    // -----------------------------------------------------------
+    // what a single expression node computes, see TermNode. value
+    // is the constant a term is compared with
+    // -----------------------------------------------------------
+    template <typename T>
+    struct ExpressionNode
+    {
+        EXPRESSION_NODE kind;
+        COMPARISON comparison;
+        CONNECTIVE connective;
+        T value;
+        const Term<T> *terms[2];
+        const std::function<bool(T)> *comparer;
+        const std::function<bool(T, T)> *comparer2;
+        const std::function<bool(bool)> *modifier;
+        const std::function<bool(bool, bool)> *combiner;
+        const std::shared_ptr<LogicalExpressionBehavior<T>> *operands[2];
+    };
+
 
     template <typename T>
     class LogicalExpressionBehavior
@@ -29,6 +147,7 @@ namespace tc
         friend class ModifiedExpressionBehavior < T > ;
         friend class CombinedExpressionBehavior < T > ;
         friend class LogicalExpression < T > ;
+        friend class Inspection < T > ;
 
     public:
         virtual ~LogicalExpressionBehavior(void){}
@@ -38,6 +157,8 @@ namespace tc
 
     private:
         virtual bool evaluate(const std::vector<T> &values) const = 0;
+        virtual void collectVariables(std::vector<size_t> &indices) const = 0;
+        virtual void describe(ExpressionNode<T> &node) const = 0;
     };
 
     template <typename T>
@@ -52,17 +173,33 @@ namespace tc
         Term<T> m_atom1;
         Term<T> m_atom2;
         std::function<bool(T, T)> m_comparer;
+        COMPARISON m_comparison;
 
     public:
+        CombinedTermExpressionBehavior(BehaviorKey<T>, Term<T> a1, Term<T> a2, std::function<bool(T, T)> f, COMPARISON cmp = CMP_CUSTOM) :
+            m_atom1(std::move(a1)), m_atom2(std::move(a2)), m_comparer(std::move(f)), m_comparison(cmp) {}
         virtual ~CombinedTermExpressionBehavior(void){}
 
     private:
         CombinedTermExpressionBehavior(void) = delete;
-        CombinedTermExpressionBehavior(const Term<T> &a1, const Term<T> &a2, std::function<bool(T, T)> f) :
-            m_atom1(a1), m_atom2(a2), m_comparer(f) {}
         virtual bool evaluate(const std::vector<T> &values) const
         {
-            return m_comparer(m_atom1.subst(values), m_atom2.subst(values));
+            return m_comparer(m_atom1.substitute(values), m_atom2.substitute(values));
+        }
+        virtual void collectVariables(std::vector<size_t> &indices) const
+        {
+            std::vector<size_t> vars1 = m_atom1.variables();
+            std::vector<size_t> vars2 = m_atom2.variables();
+            indices.insert(indices.end(), vars1.begin(), vars1.end());
+            indices.insert(indices.end(), vars2.begin(), vars2.end());
+        }
+        virtual void describe(ExpressionNode<T> &node) const
+        {
+            node.kind = EXPR_TERMS;
+            node.comparison = m_comparison;
+            node.terms[0] = &m_atom1;
+            node.terms[1] = &m_atom2;
+            node.comparer2 = &m_comparer;
         }
     };
 
@@ -77,18 +214,33 @@ namespace tc
     private:
         Term<T> m_atom;
         std::function<bool(T)> m_comparer;
+        COMPARISON m_comparison;
+        T m_const;
 
     public:
+        SingleTermExpressionBehavior(BehaviorKey<T>, Term<T> a, std::function<bool(T)> f, COMPARISON cmp = CMP_CUSTOM, T val = T()) :
+            m_atom(std::move(a)), m_comparer(std::move(f)), m_comparison(cmp), m_const(val) {}
         virtual ~SingleTermExpressionBehavior(void){}
 
     private:
         SingleTermExpressionBehavior(void) = delete;
-        SingleTermExpressionBehavior(const Term<T> &a, std::function<bool(T)> f) :
-            m_atom(a), m_comparer(f) {}
         virtual bool evaluate(const std::vector<T> &values) const
         {
             return m_comparer(m_atom.substitute(values));
         }
+        virtual void collectVariables(std::vector<size_t> &indices) const
+        {
+            std::vector<size_t> vars = m_atom.variables();
+            indices.insert(indices.end(), vars.begin(), vars.end());
+        }
+        virtual void describe(ExpressionNode<T> &node) const
+        {
+            node.kind = EXPR_TERM;
+            node.comparison = m_comparison;
+            node.value = m_const;
+            node.terms[0] = &m_atom;
+            node.comparer = &m_comparer;
+        }
     };
 
 
@@ -102,18 +254,30 @@ namespace tc
     private:
         std::shared_ptr<LogicalExpressionBehavior<T>> m_expr;
         std::function<bool(bool)> m_modifier;
+        CONNECTIVE m_connective;
 
     public:
+        ModifiedExpressionBehavior(BehaviorKey<T>, std::shared_ptr<LogicalExpressionBehavior<T>> e, std::function<bool(bool)> f, CONNECTIVE con = LOGIC_CUSTOM) :
+            m_expr(std::move(e)), m_modifier(std::move(f)), m_connective(con) {}
         virtual ~ModifiedExpressionBehavior(void){}
 
     private:
         ModifiedExpressionBehavior(void) = delete;
-        ModifiedExpressionBehavior(std::shared_ptr<LogicalExpressionBehavior<T>> e, std::function<bool(bool)> f) :
-            m_expr(e), m_modifier(f) {}
         virtual bool evaluate(const std::vector<T> &values) const
         {
             return m_modifier(m_expr->evaluate(values));
         }
+        virtual void collectVariables(std::vector<size_t> &indices) const
+        {
+            m_expr->collectVariables(indices);
+        }
+        virtual void describe(ExpressionNode<T> &node) const
+        {
+            node.kind = EXPR_MODIFIED;
+            node.connective = m_connective;
+            node.modifier = &m_modifier;
+            node.operands[0] = &m_expr;
+        }
     };
 
 
@@ -128,20 +292,35 @@ namespace tc
         std::shared_ptr<LogicalExpressionBehavior<T>> m_expr1;
         std::shared_ptr<LogicalExpressionBehavior<T>> m_expr2;
         std::function<bool(bool, bool)> m_combiner;
+        CONNECTIVE m_connective;
 
     public:
+        CombinedExpressionBehavior(BehaviorKey<T>, std::shared_ptr<LogicalExpressionBehavior<T>> e1,
+            std::shared_ptr<LogicalExpressionBehavior<T>> e2,
+            std::function<bool(bool, bool)> f,
+            CONNECTIVE con = LOGIC_CUSTOM) :
+            m_expr1(std::move(e1)), m_expr2(std::move(e2)), m_combiner(std::move(f)), m_connective(con) {}
         virtual ~CombinedExpressionBehavior(void){}
 
     private:
         CombinedExpressionBehavior(void) = delete;
-        CombinedExpressionBehavior(std::shared_ptr<LogicalExpressionBehavior<T>> e1,
-            std::shared_ptr<LogicalExpressionBehavior<T>> e2,
-            std::function<bool(bool, bool)> f) :
-            m_expr1(e1), m_expr2(e2), m_combiner(f) {}
         virtual bool evaluate(const std::vector<T> &values) const
         {
             return m_combiner(m_expr1->evaluate(values), m_expr2->evaluate(values));
         }
+        virtual void collectVariables(std::vector<size_t> &indices) const
+        {
+            m_expr1->collectVariables(indices);
+            m_expr2->collectVariables(indices);
+        }
+        virtual void describe(ExpressionNode<T> &node) const
+        {
+            node.kind = EXPR_COMBINED;
+            node.connective = m_connective;
+            node.combiner = &m_combiner;
+            node.operands[0] = &m_expr1;
+            node.operands[1] = &m_expr2;
+        }
     };
 
 }
@@ -4,6 +4,7 @@
 #include "stdafx.h"
 
 #include "LogicalExpression.h"
+#include "Plan.h"
 #include "Features.h"
 
 #include <vector>
@@ -59,8 +60,12 @@ int main(int argc, char* argv[])
     std::vector<Term<double>> atoms = { cX, cY, newFeat, newFeat2, newFeat3, newFeat4 };
     std::vector<LogicalExpression<double>> expressions = { exp, exp1, exp2 };
 
-    std::vector<std::vector<double>> substResults = substitute(valuesVec, atoms);
-    std::vector<std::vector<bool>> evalResults = evaluate(valuesVec, expressions);
+    // compute the features and evaluate the expressions in one pass,
+    // the same as substitute(valuesVec, atoms) and evaluate(valuesVec, expressions)
+    Plan<double> plan(atoms, expressions);
+    std::vector<std::vector<double>> substResults;
+    std::vector<std::vector<bool>> evalResults;
+    plan.run(valuesVec, substResults, evalResults);
 
     std::cout << "Results for values1" << std::endl;
     std::cout << "Evaluate exp: " << evalResults[0][0] << std::endl;
@@ -0,0 +1,358 @@
+// -----------------------------------------------------------
+// NUMA aware multi-threaded evaluation
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// substitutes terms and evaluates expressions for various
+// vectors with one group of threads per NUMA node. the batch
+// is split into blocks, every block goes to the node its
+// vectors are stored on. the threads of a node are pinned to
+// its cpus and work on a copy of the compiled plan made on
+// that node, the result rows are allocated by the thread that
+// writes them. once a node has run out of blocks its threads
+// help the others.
+// only the cpus the process may run on (taskset, cpusets) are
+// used, nodes without any of them are left out.
+// without NUMA information (or on windows) all cpus form one
+// node and the threads are not pinned.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "Plan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tc
+{
+    // number of vectors a thread takes at once
+    const size_t NUMA_BLOCK = 4096;
+
+    // -----------------------------------------------------------
+    // a NUMA node and the cpus belonging to it, no cpus means the
+    // threads of the node are not pinned
+    // -----------------------------------------------------------
+    struct NumaNode
+    {
+        int id;
+        std::vector<int> cpus;
+    };
+
+    namespace numa
+    {
+        // -----------------------------------------------------------
+        // parse a cpu list like "0-3,8,10-11"
+        // -----------------------------------------------------------
+        inline std::vector<int> parseCpuList(const std::string &list)
+        {
+            std::vector<int> cpus;
+            size_t pos = 0;
+            while (pos < list.size())
+            {
+                size_t end = list.find(',', pos);
+                if (end == std::string::npos)
+                    end = list.size();
+
+                const std::string range = list.substr(pos, end - pos);
+                const size_t dash = range.find('-');
+                if (!range.empty() && range.find_first_not_of("0123456789-\n") == std::string::npos)
+                {
+                    const int first = std::stoi(range.substr(0, dash));
+                    const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                    for (int cpu = first; cpu <= last; ++cpu)
+                        cpus.push_back(cpu);
+                }
+                pos = end + 1;
+            }
+
+            return cpus;
+        }
+
+        // -----------------------------------------------------------
+        // the node a piece of memory is on, -1 if unknown (e.g. not
+        // touched yet or no NUMA support)
+        // -----------------------------------------------------------
+        inline int nodeOfAddress(const void *address)
+        {
+#if defined(__linux__) && defined(SYS_move_pages)
+            static const std::uintptr_t pageMask = ~std::uintptr_t(sysconf(_SC_PAGESIZE) - 1);
+            // without target nodes move_pages only reports where the page is
+            void *page = reinterpret_cast<void*>(reinterpret_cast<std::uintptr_t>(address) & pageMask);
+            int status = -1;
+            if (syscall(SYS_move_pages, 0, 1UL, &page, nullptr, &status, 0) == 0 && status >= 0)
+                return status;
+#endif
+            return -1;
+        }
+
+        // -----------------------------------------------------------
+        // the cpus the process may run on in ascending order, empty
+        // if unknown
+        // -----------------------------------------------------------
+        inline std::vector<int> allowedCpus()
+        {
+            std::vector<int> cpus;
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            {
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                    if (CPU_ISSET(cpu, &set))
+                        cpus.push_back(cpu);
+            }
+#endif
+            return cpus;
+        }
+
+        // number of cpus the process may run on
+        inline size_t numCpus()
+        {
+            const size_t allowed = allowedCpus().size();
+            return allowed ? allowed : std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // -----------------------------------------------------------
+        // restrict the calling thread to the given cpus
+        // -----------------------------------------------------------
+        inline bool pinThread(const std::vector<int> &cpus)
+        {
+#ifdef __linux__
+            if (cpus.empty())
+                return false;
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (auto cpu : cpus)
+                if (cpu >= 0 && cpu < CPU_SETSIZE)
+                    CPU_SET(cpu, &set);
+
+            return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+            return false;
+#endif
+        }
+
+        // -----------------------------------------------------------
+        // joins the threads still running when it goes out of scope,
+        // so the threads started before a failing one are not
+        // destroyed while joinable (std::terminate)
+        // -----------------------------------------------------------
+        class ThreadJoiner final
+        {
+        private:
+            std::vector<std::thread> &m_threads;
+
+        public:
+            explicit ThreadJoiner(std::vector<std::thread> &threads) : m_threads(threads) {}
+            ~ThreadJoiner()
+            {
+                for (auto & t : m_threads)
+                    if (t.joinable())
+                        t.join();
+            }
+
+        private:
+            ThreadJoiner() = delete;
+            ThreadJoiner(const ThreadJoiner &) = delete;
+            ThreadJoiner& operator=(const ThreadJoiner &) = delete;
+        };
+    }
+
+    // -----------------------------------------------------------
+    // the NUMA nodes of the machine that have cpus, sorted by id
+    // -----------------------------------------------------------
+    inline std::vector<NumaNode> numaNodes()
+    {
+        std::vector<NumaNode> nodes;
+#ifdef __linux__
+        const std::vector<int> allowed = numa::allowedCpus();
+        if (DIR *dir = opendir("/sys/devices/system/node"))
+        {
+            while (dirent *entry = readdir(dir))
+            {
+                const std::string name = entry->d_name;
+                if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+                    name.find_first_not_of("0123456789", 4) != std::string::npos)
+                    continue;
+
+                std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+                std::string list;
+                std::getline(file, list);
+
+                NumaNode node = { std::stoi(name.substr(4)), numa::parseCpuList(list) };
+                if (!allowed.empty())
+                {
+                    node.cpus.erase(std::remove_if(node.cpus.begin(), node.cpus.end(), [&allowed](int cpu) {
+                        return !std::binary_search(allowed.begin(), allowed.end(), cpu);
+                    }), node.cpus.end());
+                }
+                if (!node.cpus.empty())
+                    nodes.push_back(std::move(node));
+            }
+            closedir(dir);
+        }
+        std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+#endif
+
+        if (nodes.empty())
+        {
+            NumaNode node = { 0, std::vector<int>() };
+            nodes.push_back(std::move(node));
+        }
+
+        return nodes;
+    }
+
+    // -----------------------------------------------------------
+    // run a plan for various vectors on all NUMA nodes, with
+    // threadsPerNode threads per node (0 = one per cpu)
+    // -----------------------------------------------------------
+    template <typename T>
+    void runNuma(const Plan<T> &plan,
+        const std::vector<std::vector<T>> &valuesVec,
+        std::vector<std::vector<T>> &substVec,
+        std::vector<std::vector<bool>> &evalVec,
+        size_t threadsPerNode = 0)
+    {
+        const std::vector<NumaNode> nodes = numaNodes();
+        const size_t numBlocks = (valuesVec.size() + NUMA_BLOCK - 1) / NUMA_BLOCK;
+
+        substVec.resize(valuesVec.size());
+        evalVec.resize(valuesVec.size());
+        if (numBlocks == 0)
+            return;
+
+        // hand every block to the node its first vector is stored on,
+        // blocks of unknown nodes are dealt out in turn
+        std::vector<std::vector<size_t>> nodeBlocks(nodes.size());
+        for (size_t b = 0; b < numBlocks; ++b)
+        {
+            const int id = nodes.size() > 1 ? numa::nodeOfAddress(valuesVec[b * NUMA_BLOCK].data()) : -1;
+            size_t n = 0;
+            while (n < nodes.size() && nodes[n].id != id)
+                ++n;
+            nodeBlocks[n < nodes.size() ? n : b % nodes.size()].push_back(b);
+        }
+
+        std::unique_ptr<std::atomic<size_t>[]> next(new std::atomic<size_t>[nodes.size()]);
+        for (size_t n = 0; n < nodes.size(); ++n)
+            next[n].store(0);
+
+        std::vector<std::exception_ptr> errors(nodes.size());
+        std::vector<std::thread> leaders;
+        numa::ThreadJoiner joinLeaders(leaders);
+        leaders.reserve(nodes.size());
+        for (size_t n = 0; n < nodes.size(); ++n)
+        {
+            leaders.push_back(std::thread([&, n]() {
+                try
+                {
+                    numa::pinThread(nodes[n].cpus);
+                    // the copy is allocated on the node the leader runs on
+                    const Plan<T> replica(plan);
+
+                    std::atomic<bool> failed(false);
+                    std::exception_ptr workerError;
+                    auto work = [&]() {
+                        try
+                        {
+                            numa::pinThread(nodes[n].cpus);
+                            // own blocks first, then those of the other nodes
+                            for (size_t k = 0; k < nodes.size() && !failed.load(); ++k)
+                            {
+                                const size_t m = (n + k) % nodes.size();
+                                while (!failed.load())
+                                {
+                                    const size_t i = next[m].fetch_add(1);
+                                    if (i >= nodeBlocks[m].size())
+                                        break;
+
+                                    const size_t first = nodeBlocks[m][i] * NUMA_BLOCK;
+                                    replica.run(valuesVec, first, std::min(NUMA_BLOCK, valuesVec.size() - first), substVec, evalVec);
+                                }
+                            }
+                        }
+                        catch (...)
+                        {
+                            if (!failed.exchange(true))
+                                workerError = std::current_exception();
+                        }
+                    };
+
+                    size_t numThreads = threadsPerNode;
+                    if (numThreads == 0)
+                        numThreads = nodes[n].cpus.empty() ? numa::numCpus() : nodes[n].cpus.size();
+
+                    std::vector<std::thread> workers;
+                    numa::ThreadJoiner joinWorkers(workers);
+                    workers.reserve(numThreads - 1);
+                    for (size_t t = 1; t < numThreads; ++t)
+                        workers.push_back(std::thread(work));
+                    work();
+                    for (auto & w : workers)
+                        w.join();
+
+                    if (workerError)
+                        std::rethrow_exception(workerError);
+                }
+                catch (...)
+                {
+                    errors[n] = std::current_exception();
+                }
+            }));
+        }
+
+        for (auto & l : leaders)
+            l.join();
+
+        for (auto & e : errors)
+            if (e)
+                std::rethrow_exception(e);
+    }
+
+    // -----------------------------------------------------------
+    // NUMA aware versions of tc::evaluate and tc::substitute for
+    // various vectors at once
+    // -----------------------------------------------------------
+    template <typename T>
+    std::vector<std::vector<bool>> evaluateNuma(const std::vector<std::vector<T>> &valuesVec,
+        const std::vector<LogicalExpression<T>> &expressions,
+        size_t threadsPerNode = 0)
+    {
+        std::vector<std::vector<T>> substVec;
+        std::vector<std::vector<bool>> evalVec;
+        runNuma(Plan<T>(std::vector<Term<T>>(), expressions), valuesVec, substVec, evalVec, threadsPerNode);
+
+        return evalVec;
+    }
+
+    template <typename T>
+    std::vector<std::vector<T>> substituteNuma(const std::vector<std::vector<T>> &valuesVec,
+        const std::vector<Term<T>> &terms,
+        size_t threadsPerNode = 0)
+    {
+        std::vector<std::vector<T>> substVec;
+        std::vector<std::vector<bool>> evalVec;
+        runNuma(Plan<T>(terms, std::vector<LogicalExpression<T>>()), valuesVec, substVec, evalVec, threadsPerNode);
+
+        return substVec;
+    }
+
+}
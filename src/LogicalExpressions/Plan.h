@@ -0,0 +1,327 @@
+// -----------------------------------------------------------
+// Plan class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// computes a bunch of terms and a bunch of logical expressions
+// for various vectors in a single pass. terms and expressions
+// are compiled into one program: a term node is created once
+// for every distinct (sub)term, no matter how many output terms
+// and expressions use it (see TermNumbering), followed by the
+// atomic predicates and the gates combining them (see Circuit).
+// the program runs on blocks of vectors, so every node fills a
+// column of values that the nodes above it read.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "Circuit.h"
+#include "TermNumbering.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+namespace tc
+{
+
+    template <typename T>
+    class Plan final
+    {
+    private:
+        // -----------------------------------------------------------
+        // a term node, inputs index the nodes before it. a variable
+        // node keeps the index of its variable in input1
+        // -----------------------------------------------------------
+        struct Node
+        {
+            TERM_NODE kind;
+            TERM_OP op;
+            size_t input1;
+            size_t input2;
+            T value;
+            std::function<T(T)> modifier;
+            std::function<T(T, T)> combiner;
+        };
+
+        // -----------------------------------------------------------
+        // an atomic expression, compares the values of term nodes or
+        // the value of one node with a constant (no second term)
+        // -----------------------------------------------------------
+        struct Predicate
+        {
+            COMPARISON comparison;
+            size_t term1;
+            size_t term2;
+            T value;
+            std::function<bool(T)> comparer;
+            std::function<bool(T, T)> comparer2;
+        };
+
+        static const size_t NO_INPUT = ~size_t(0);
+
+        typedef std::tuple<int, size_t, size_t, T> PredicateKey;
+
+        // bookkeeping while compiling
+        struct Compilation
+        {
+            TermNumbering<T> terms;
+            std::map<PredicateKey, size_t> predicateKeys;
+        };
+
+        std::vector<Node> m_nodes;
+        std::vector<Predicate> m_predicates;
+        Circuit<T> m_circuit;
+        std::vector<size_t> m_termOutputs;
+        std::vector<size_t> m_expressionOutputs;
+
+    public:
+        Plan(const std::vector<Term<T>> &terms, const std::vector<LogicalExpression<T>> &expressions)
+        {
+            Compilation comp;
+
+            m_termOutputs.reserve(terms.size());
+            for (auto & t : terms)
+                m_termOutputs.push_back(compileTerm(*Inspection<T>::behavior(t), comp));
+
+            auto predicate = [this, &comp](const std::shared_ptr<LogicalExpressionBehavior<T>> &, const ExpressionNode<T> &node) {
+                return addPredicate(node, comp);
+            };
+            m_expressionOutputs.reserve(expressions.size());
+            for (auto & e : expressions)
+                m_expressionOutputs.push_back(m_circuit.compile(Inspection<T>::behavior(e), predicate));
+            m_circuit.finish(m_predicates.size(), m_expressionOutputs);
+        }
+        ~Plan() {}
+
+        size_t numTerms() const { return m_termOutputs.size(); }
+        size_t numExpressions() const { return m_expressionOutputs.size(); }
+        size_t numNodes() const { return m_nodes.size(); }
+        size_t numPredicates() const { return m_predicates.size(); }
+        size_t numGates() const { return m_circuit.size(); }
+
+        // -----------------------------------------------------------
+        // the values of the terms and the results of the expressions
+        // for every vector, laid out as tc::substitute and
+        // tc::evaluate return them
+        // -----------------------------------------------------------
+        void run(const std::vector<std::vector<T>> &valuesVec,
+            std::vector<std::vector<T>> &substVec,
+            std::vector<std::vector<bool>> &evalVec) const
+        {
+            substVec.resize(valuesVec.size());
+            evalVec.resize(valuesVec.size());
+            run(valuesVec, 0, valuesVec.size(), substVec, evalVec);
+        }
+
+        // -----------------------------------------------------------
+        // the same for the vectors [first, first + n) only, substVec
+        // and evalVec must already have one row per vector. only the
+        // rows of the range are written, so threads can share a batch
+        // -----------------------------------------------------------
+        void run(const std::vector<std::vector<T>> &valuesVec, size_t first, size_t n,
+            std::vector<std::vector<T>> &substVec,
+            std::vector<std::vector<bool>> &evalVec) const
+        {
+            if (first + n > valuesVec.size() || substVec.size() < valuesVec.size() || evalVec.size() < valuesVec.size())
+                throw(std::out_of_range("Range of vectors exceeds the batch of the plan."));
+
+            // small ranges do not need room for a whole block
+            const size_t stride = std::min(n, SUBSTITUTION_BLOCK);
+            std::vector<T> columns(m_nodes.size() * stride);
+            std::vector<unsigned char> table((m_predicates.size() + m_circuit.size()) * stride);
+            for (size_t r = first; r < first + n; r += stride)
+            {
+                const size_t m = std::min(stride, first + n - r);
+                evaluateBlock(valuesVec.data() + r, m, stride, columns.data(), table.data());
+
+                for (size_t i = 0; i < m; ++i)
+                    collect(columns.data() + i, table.data() + i, stride, substVec[r + i], evalVec[r + i]);
+            }
+        }
+
+        void run(const std::vector<T> &values, std::vector<T> &subst, std::vector<bool> &eval) const
+        {
+            std::vector<T> columns(m_nodes.size());
+            std::vector<unsigned char> table(m_predicates.size() + m_circuit.size());
+            evaluateBlock(&values, 1, 1, columns.data(), table.data());
+            collect(columns.data(), table.data(), 1, subst, eval);
+        }
+
+    private:
+        Plan() = delete;
+
+        // -----------------------------------------------------------
+        // run the program on a block of n <= stride vectors. node k
+        // writes its values to columns[k * stride], predicates and
+        // gates write to the table in the same way
+        // -----------------------------------------------------------
+        void evaluateBlock(const std::vector<T> *valuesVec, size_t n, size_t stride, T *columns, unsigned char *table) const
+        {
+            for (size_t k = 0; k < m_nodes.size(); ++k)
+            {
+                const Node &node = m_nodes[k];
+                T *out = columns + k * stride;
+                switch (node.kind)
+                {
+                case TERM_CONST:
+                    std::fill(out, out + n, node.value);
+                    break;
+                case TERM_VARIABLE:
+                    for (size_t r = 0; r < n; ++r)
+                    {
+                        if (node.input1 < valuesVec[r].size())
+                            out[r] = valuesVec[r][node.input1];
+                        else
+                            throw(std::out_of_range("Index out of bounds for substitution in CTerm."));
+                    }
+                    break;
+                case TERM_MODIFIED:
+                {
+                    const T *in = columns + node.input1 * stride;
+                    if (node.op == OP_CUSTOM)
+                    {
+                        for (size_t r = 0; r < n; ++r)
+                            out[r] = node.modifier(in[r]);
+                    }
+                    else
+                    {
+                        std::copy(in, in + n, out);
+                        applyOperation(node.op, out, node.value, n);
+                    }
+                    break;
+                }
+                case TERM_COMBINED:
+                {
+                    const T *in1 = columns + node.input1 * stride;
+                    const T *in2 = columns + node.input2 * stride;
+                    if (node.op == OP_CUSTOM)
+                    {
+                        for (size_t r = 0; r < n; ++r)
+                            out[r] = node.combiner(in1[r], in2[r]);
+                    }
+                    else
+                    {
+                        std::copy(in1, in1 + n, out);
+                        applyOperation(node.op, out, in2, n);
+                    }
+                    break;
+                }
+                }
+            }
+
+            for (size_t p = 0; p < m_predicates.size(); ++p)
+            {
+                const Predicate &pred = m_predicates[p];
+                const T *a = columns + pred.term1 * stride;
+                unsigned char *out = table + p * stride;
+                if (pred.term2 == NO_INPUT)
+                    compare(pred, a, out, n);
+                else
+                    compare(pred, a, columns + pred.term2 * stride, out, n);
+            }
+
+            m_circuit.run(table, stride, n);
+        }
+
+        // -----------------------------------------------------------
+        // the outputs of one vector of a block, columns and table
+        // point at its first entries
+        // -----------------------------------------------------------
+        void collect(const T *columns, const unsigned char *table, size_t stride,
+            std::vector<T> &subst, std::vector<bool> &eval) const
+        {
+            subst.resize(m_termOutputs.size());
+            eval.resize(m_expressionOutputs.size());
+            for (size_t t = 0; t < m_termOutputs.size(); ++t)
+                subst[t] = columns[m_termOutputs[t] * stride];
+            for (size_t e = 0; e < m_expressionOutputs.size(); ++e)
+                eval[e] = table[m_expressionOutputs[e] * stride] != 0;
+        }
+
+        // -----------------------------------------------------------
+        // comparison of a column with a constant or another column
+        // -----------------------------------------------------------
+        static void compare(const Predicate &pred, const T *a, unsigned char *out, size_t n)
+        {
+            const T val = pred.value;
+            switch (pred.comparison)
+            {
+            case CMP_LESS: for (size_t r = 0; r < n; ++r) out[r] = a[r] < val; break;
+            case CMP_LESS_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] <= val; break;
+            case CMP_GREATER: for (size_t r = 0; r < n; ++r) out[r] = a[r] > val; break;
+            case CMP_GREATER_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] >= val; break;
+            case CMP_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] == val; break;
+            case CMP_NOT_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] != val; break;
+            default: for (size_t r = 0; r < n; ++r) out[r] = pred.comparer(a[r]); break;
+            }
+        }
+
+        static void compare(const Predicate &pred, const T *a, const T *b, unsigned char *out, size_t n)
+        {
+            switch (pred.comparison)
+            {
+            case CMP_LESS: for (size_t r = 0; r < n; ++r) out[r] = a[r] < b[r]; break;
+            case CMP_LESS_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] <= b[r]; break;
+            case CMP_GREATER: for (size_t r = 0; r < n; ++r) out[r] = a[r] > b[r]; break;
+            case CMP_GREATER_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] >= b[r]; break;
+            case CMP_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] == b[r]; break;
+            case CMP_NOT_EQUAL: for (size_t r = 0; r < n; ++r) out[r] = a[r] != b[r]; break;
+            default: for (size_t r = 0; r < n; ++r) out[r] = pred.comparer2(a[r], b[r]); break;
+            }
+        }
+
+        // -----------------------------------------------------------
+        // compile a term into nodes, returns the index of the node
+        // computing its value
+        // -----------------------------------------------------------
+        size_t compileTerm(const TermBehavior<T> &tb, Compilation &comp)
+        {
+            auto newNode = [this](const TermNode<T> &tn, size_t input1, size_t input2) {
+                Node node = { tn.kind, tn.op, input1, input2, tn.value, nullptr, nullptr };
+                if (tn.modifier)
+                    node.modifier = *tn.modifier;
+                if (tn.combiner)
+                    node.combiner = *tn.combiner;
+                m_nodes.push_back(std::move(node));
+            };
+            return comp.terms.number(&tb, newNode);
+        }
+
+        // -----------------------------------------------------------
+        // predefined comparisons of the same nodes (and the same
+        // constant) are one predicate
+        // -----------------------------------------------------------
+        size_t addPredicate(const ExpressionNode<T> &node, Compilation &comp)
+        {
+            Predicate pred = { node.comparison, compileTerm(*Inspection<T>::behavior(*node.terms[0]), comp), NO_INPUT,
+                node.value, nullptr, nullptr };
+            if (node.kind == EXPR_TERMS)
+            {
+                pred.term2 = compileTerm(*Inspection<T>::behavior(*node.terms[1]), comp);
+                pred.comparer2 = *node.comparer2;
+            }
+            else
+                pred.comparer = *node.comparer;
+
+            if (pred.comparison == CMP_CUSTOM || pred.value != pred.value)
+            {
+                m_predicates.push_back(std::move(pred));
+                return m_predicates.size() - 1;
+            }
+
+            PredicateKey key(pred.comparison, pred.term1, pred.term2, pred.value);
+            auto pit = comp.predicateKeys.find(key);
+            if (pit != comp.predicateKeys.end())
+                return pit->second;
+
+            m_predicates.push_back(std::move(pred));
+            return comp.predicateKeys[key] = m_predicates.size() - 1;
+        }
+    };
+
+    template <typename T> const size_t Plan<T>::NO_INPUT;
+
+}
@@ -0,0 +1,139 @@
+// -----------------------------------------------------------
+// RuleSet class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// compiles a bunch of logical expressions into a table of
+// distinct atomic predicates and a boolean circuit over them.
+// every predicate is evaluated exactly once per vector, the
+// rules are then resolved by the gates of the circuit (see
+// Circuit). gates that occur in several rules are shared as
+// well. predicates are recognised by structure, the terms are
+// numbered by TermNumbering.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "Circuit.h"
+#include "TermNumbering.h"
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include <memory>
+
+namespace tc
+{
+
+    template <typename T>
+    class RuleSet final
+    {
+    private:
+        typedef std::tuple<int, size_t, size_t, T> PredicateKey;
+
+        // -----------------------------------------------------------
+        // state only needed while compiling
+        // -----------------------------------------------------------
+        struct Compilation
+        {
+            TermNumbering<T> terms;
+            std::map<PredicateKey, size_t> predicateKeys;
+        };
+
+        std::vector<std::shared_ptr<LogicalExpressionBehavior<T>>> m_predicates;
+        Circuit<T> m_circuit;
+        std::vector<size_t> m_outputs;
+
+    public:
+        explicit RuleSet(const std::vector<LogicalExpression<T>> &expressions)
+        {
+            Compilation comp;
+            auto predicate = [this, &comp](const std::shared_ptr<LogicalExpressionBehavior<T>> &leb, const ExpressionNode<T> &node) {
+                return addPredicate(leb, node, comp);
+            };
+
+            m_outputs.reserve(expressions.size());
+            for (auto & e : expressions)
+                m_outputs.push_back(m_circuit.compile(Inspection<T>::behavior(e), predicate));
+            m_circuit.finish(m_predicates.size(), m_outputs);
+        }
+        ~RuleSet() {}
+
+        size_t numRules() const { return m_outputs.size(); }
+        size_t numPredicates() const { return m_predicates.size(); }
+        size_t numGates() const { return m_circuit.size(); }
+
+        std::vector<bool> evaluate(const std::vector<T> &values) const
+        {
+            std::vector<unsigned char> table(m_predicates.size() + m_circuit.size());
+            std::vector<bool> evalVec(m_outputs.size());
+            evaluate(values, table, evalVec);
+
+            return evalVec;
+        }
+
+        std::vector<std::vector<bool>> evaluate(const std::vector<std::vector<T>> &valuesVec) const
+        {
+            std::vector<unsigned char> table(m_predicates.size() + m_circuit.size());
+            std::vector<std::vector<bool>> evalVec(valuesVec.size(), std::vector<bool>(m_outputs.size()));
+            for (size_t r = 0; r < valuesVec.size(); ++r)
+                evaluate(valuesVec[r], table, evalVec[r]);
+
+            return evalVec;
+        }
+
+    private:
+        RuleSet() = delete;
+
+        // -----------------------------------------------------------
+        // fill the predicate table for one vector, run the circuit
+        // and pick the rule outputs
+        // -----------------------------------------------------------
+        void evaluate(const std::vector<T> &values, std::vector<unsigned char> &table, std::vector<bool> &evalVec) const
+        {
+            const size_t numPred = m_predicates.size();
+            for (size_t p = 0; p < numPred; ++p)
+                table[p] = Inspection<T>::evaluate(*m_predicates[p], values);
+
+            m_circuit.run(table.data(), 1, 1);
+
+            for (size_t o = 0; o < m_outputs.size(); ++o)
+                evalVec[o] = table[m_outputs[o]] != 0;
+        }
+
+        // -----------------------------------------------------------
+        // predefined comparisons of terms with the same numbers (and
+        // the same constant) are the same predicate, custom comparers
+        // are only shared if the expression object itself is shared
+        // -----------------------------------------------------------
+        size_t addPredicate(const std::shared_ptr<LogicalExpressionBehavior<T>> &leb, const ExpressionNode<T> &node,
+            Compilation &comp)
+        {
+            // NaN constants would break the ordering of the keys
+            if (node.comparison == CMP_CUSTOM || node.value != node.value)
+            {
+                m_predicates.push_back(leb);
+                return m_predicates.size() - 1;
+            }
+
+            PredicateKey key(node.comparison, number(*node.terms[0], comp),
+                node.kind == EXPR_TERMS ? number(*node.terms[1], comp) : TermNumbering<T>::NO_INPUT, node.value);
+            auto pit = comp.predicateKeys.find(key);
+            if (pit != comp.predicateKeys.end())
+                return pit->second;
+
+            m_predicates.push_back(leb);
+            return comp.predicateKeys[key] = m_predicates.size() - 1;
+        }
+
+        // the predicates evaluate their own terms, only the numbers
+        // are needed
+        static size_t number(const Term<T> &term, Compilation &comp)
+        {
+            auto ignore = [](const TermNode<T>&, size_t, size_t) {};
+            return comp.terms.number(Inspection<T>::behavior(term).get(), ignore);
+        }
+    };
+
+
+}
@@ -0,0 +1,250 @@
+// -----------------------------------------------------------
+// RuleSetHandle class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// versioned handle to a compiled rule set that can be updated
+// while other threads are evaluating. readers pin the current
+// version at batch boundaries without locking or waiting,
+// writers publish a new version and reclaim old ones as soon
+// as no reader pinned before the update is still active
+// (epoch based reclamation).
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "RuleSet.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace tc
+{
+
+    template <typename T>
+    class RuleSetHandle final
+    {
+    private:
+        // -----------------------------------------------------------
+        // a published version of the rule set
+        // -----------------------------------------------------------
+        struct Version
+        {
+            Version(const std::vector<LogicalExpression<T>> &expressions, std::uint64_t n) :
+                ruleSet(expressions), number(n), retireEpoch(0) {}
+
+            RuleSet<T> ruleSet;
+            std::uint64_t number;
+            std::uint64_t retireEpoch;
+        };
+
+        // reader slot states besides the epoch a reader is pinned at
+        static const std::uint64_t SLOT_IDLE = ~std::uint64_t(0);
+        static const std::uint64_t SLOT_FREE = ~std::uint64_t(0) - 1;
+
+        // -----------------------------------------------------------
+        // the pin of one reader. the slot is owned by the reader and
+        // its live guard, whichever of them goes last frees it
+        // -----------------------------------------------------------
+        struct Slot
+        {
+            Slot() : epoch(SLOT_IDLE), owners(1) {}
+
+            std::atomic<std::uint64_t> epoch;
+            std::atomic<unsigned> owners;
+
+            void release()
+            {
+                if (owners.fetch_sub(1) == 1)
+                    epoch.store(SLOT_FREE);
+            }
+        };
+
+        std::atomic<Version*> m_current;
+        std::atomic<std::uint64_t> m_epoch;
+
+        // only touched by writers and reader registration
+        std::mutex m_mutex;
+        std::list<Slot> m_slots;
+        std::vector<Version*> m_retired;
+        std::uint64_t m_nextVersion;
+
+    public:
+        // -----------------------------------------------------------
+        // pins the version that is current when it is created and
+        // keeps it alive until it goes out of scope, even if it
+        // outlives its reader
+        // -----------------------------------------------------------
+        class Guard final
+        {
+            friend class RuleSetHandle < T > ;
+
+        private:
+            Slot *m_slot;
+            const Version *m_version;
+
+        public:
+            Guard(Guard &&other) : m_slot(other.m_slot), m_version(other.m_version) { other.m_slot = nullptr; }
+            ~Guard()
+            {
+                if (m_slot)
+                {
+                    m_slot->epoch.store(SLOT_IDLE);
+                    m_slot->release();
+                }
+            }
+
+            const RuleSet<T>& ruleSet() const { return m_version->ruleSet; }
+            std::uint64_t version() const { return m_version->number; }
+
+        private:
+            Guard() = delete;
+            Guard(const Guard &) = delete;
+            Guard& operator=(const Guard &) = delete;
+            Guard(Slot *slot, const Version *version) : m_slot(slot), m_version(version) {}
+        };
+
+        // -----------------------------------------------------------
+        // per thread access to the handle, registering is the only
+        // part that locks. a reader must not pin twice at a time:
+        // its guard has to be gone before it pins again. the guard
+        // may outlive the reader, the slot stays pinned until then
+        // -----------------------------------------------------------
+        class Reader final
+        {
+        private:
+            RuleSetHandle<T> &m_handle;
+            Slot *m_slot;
+
+        public:
+            explicit Reader(RuleSetHandle<T> &handle) : m_handle(handle), m_slot(handle.registerReader()) {}
+            ~Reader() { m_slot->release(); }
+
+            Guard pin() const
+            {
+                if (m_slot->epoch.load() != SLOT_IDLE)
+                    throw(std::logic_error("Reader is already pinned."));
+                m_slot->owners.fetch_add(1);
+                m_slot->epoch.store(m_handle.m_epoch.load());
+                return Guard(m_slot, m_handle.m_current.load());
+            }
+
+            // evaluate one batch with the version current at its start
+            std::vector<std::vector<bool>> evaluate(const std::vector<std::vector<T>> &valuesVec) const
+            {
+                Guard guard = pin();
+                return guard.ruleSet().evaluate(valuesVec);
+            }
+
+        private:
+            Reader() = delete;
+            Reader(const Reader &) = delete;
+            Reader& operator=(const Reader &) = delete;
+        };
+
+        explicit RuleSetHandle(const std::vector<LogicalExpression<T>> &expressions) :
+            m_current(new Version(expressions, 1)), m_epoch(1), m_nextVersion(2) {}
+
+        // no reader may be alive when the handle is destroyed
+        ~RuleSetHandle()
+        {
+            delete m_current.load();
+            for (auto v : m_retired)
+                delete v;
+        }
+
+        // -----------------------------------------------------------
+        // compile and publish a new version, returns its number.
+        // the compilation happens before anything is locked
+        // -----------------------------------------------------------
+        std::uint64_t publish(const std::vector<LogicalExpression<T>> &expressions)
+        {
+            std::unique_ptr<Version> version(new Version(expressions, 0));
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            version->number = m_nextVersion++;
+            const std::uint64_t number = version->number;
+
+            Version *old = m_current.exchange(version.release());
+            old->retireEpoch = m_epoch.fetch_add(1) + 1;
+            m_retired.push_back(old);
+            reclaimLocked();
+
+            return number;
+        }
+
+        // number of the version new batches will pick up
+        std::uint64_t version() const
+        {
+            return m_current.load()->number;
+        }
+
+        // -----------------------------------------------------------
+        // free retired versions no longer pinned by any reader,
+        // returns how many are still waiting for readers
+        // -----------------------------------------------------------
+        size_t reclaim()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            reclaimLocked();
+            return m_retired.size();
+        }
+
+    private:
+        RuleSetHandle() = delete;
+        RuleSetHandle(const RuleSetHandle &) = delete;
+        RuleSetHandle& operator=(const RuleSetHandle &) = delete;
+
+        Slot* registerReader()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto & slot : m_slots)
+            {
+                // a free slot has no owners left
+                if (slot.epoch.load() == SLOT_FREE)
+                {
+                    slot.owners.store(1);
+                    slot.epoch.store(SLOT_IDLE);
+                    return &slot;
+                }
+            }
+            m_slots.emplace_back();
+            return &m_slots.back();
+        }
+
+        // -----------------------------------------------------------
+        // a reader pinned at epoch e may hold every version retired
+        // after e, so a version can go once all pins are at least
+        // at its retire epoch
+        // -----------------------------------------------------------
+        void reclaimLocked()
+        {
+            std::uint64_t minEpoch = SLOT_FREE;
+            for (auto & slot : m_slots)
+            {
+                std::uint64_t epoch = slot.epoch.load();
+                if (epoch < minEpoch)
+                    minEpoch = epoch;
+            }
+
+            size_t kept = 0;
+            for (auto v : m_retired)
+            {
+                if (v->retireEpoch <= minEpoch)
+                    delete v;
+                else
+                    m_retired[kept++] = v;
+            }
+            m_retired.resize(kept);
+        }
+    };
+
+    template <typename T> const std::uint64_t RuleSetHandle<T>::SLOT_IDLE;
+    template <typename T> const std::uint64_t RuleSetHandle<T>::SLOT_FREE;
+
+}
@@ -0,0 +1,243 @@
+// -----------------------------------------------------------
+// sharded multi-process evaluation
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// evaluates a bunch of expressions for various vectors by
+// forking worker processes, each of them evaluating a
+// contiguous range of rows. the results are written into an
+// anonymous shared memory mapping and merged by row index,
+// so the outcome is identical to tc::evaluate. a crashing
+// user lambda only takes down its worker, the coordinator
+// reports it as an exception.
+// the workers are forked, so call it from a single threaded
+// process only: a child of a multi threaded process inherits
+// locks held by the other threads (e.g. inside malloc or a
+// user lambda) and can deadlock on them. this includes the
+// threads of runNuma and of RuleSetHandle readers. a timeout
+// kills workers that hang anyway.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "LogicalExpression.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <exception>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace tc
+{
+    // -----------------------------------------------------------
+    // state of a shard as reported by its worker process
+    // -----------------------------------------------------------
+    enum SHARD_STATE : std::int32_t
+    {
+        SHARD_PENDING = 0,
+        SHARD_DONE,
+        SHARD_FAILED
+    };
+
+    // -----------------------------------------------------------
+    // per shard header in the shared mapping, the message holds
+    // the what() of an exception thrown inside the worker
+    // -----------------------------------------------------------
+    struct ShardHeader
+    {
+        std::int32_t state;
+        char message[252];
+    };
+
+#ifndef _WIN32
+    namespace sharding
+    {
+        // -----------------------------------------------------------
+        // wait for a worker until the deadline, kills it once the
+        // deadline has passed. false if it had to be killed
+        // -----------------------------------------------------------
+        inline bool waitWorker(pid_t pid, int &status, bool hasDeadline, std::chrono::steady_clock::time_point deadline)
+        {
+            if (!hasDeadline)
+            {
+                while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                    ;
+                return true;
+            }
+
+            while (true)
+            {
+                const pid_t r = waitpid(pid, &status, WNOHANG);
+                if (r == pid || (r < 0 && errno != EINTR))
+                    return true;
+                if (std::chrono::steady_clock::now() >= deadline)
+                    break;
+                usleep(1000);
+            }
+
+            kill(pid, SIGKILL);
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            return false;
+        }
+    }
+#endif
+
+    // -----------------------------------------------------------
+    // evaluate a bunch of expressions for various vectors at once
+    // using numShards worker processes (0 = number of cpus)
+    // the expressions reach the workers through fork, so nothing
+    // has to be serialized and user lambdas keep working. workers
+    // not done after timeoutMs milliseconds (0 = no limit) are
+    // killed and reported as failed. single threaded callers only,
+    // see above
+    // -----------------------------------------------------------
+    template <typename T>
+    std::vector<std::vector<bool>> evaluateSharded(const std::vector<std::vector<T>> &valuesVec,
+        const std::vector<LogicalExpression<T>> &expressions,
+        unsigned int numShards = 0,
+        unsigned int timeoutMs = 0)
+    {
+#ifdef _WIN32
+        // no fork available, fall back to the in process evaluation
+        return evaluate(valuesVec, expressions);
+#else
+        const size_t numRows = valuesVec.size();
+        const size_t numExpr = expressions.size();
+
+        if (numShards == 0)
+        {
+            long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+            numShards = numCpus > 0 ? static_cast<unsigned int>(numCpus) : 1;
+        }
+        if (numShards > numRows)
+            numShards = static_cast<unsigned int>(numRows);
+        if (numShards <= 1 || numExpr == 0)
+            return evaluate(valuesVec, expressions);
+
+        // shared layout: one header per shard followed by one byte
+        // per row and expression
+        const size_t headerSize = numShards * sizeof(ShardHeader);
+        const size_t mapSize = headerSize + numRows * numExpr;
+        void *mapping = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw(std::runtime_error("Could not map shared memory for sharded evaluation."));
+
+        ShardHeader *headers = static_cast<ShardHeader*>(mapping);
+        unsigned char *results = static_cast<unsigned char*>(mapping) + headerSize;
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        std::vector<pid_t> workers;
+        for (unsigned int s = 0; s < numShards; ++s)
+        {
+            const size_t rowBegin = numRows * s / numShards;
+            const size_t rowEnd = numRows * (s + 1) / numShards;
+
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                // worker: evaluate the row range and leave without
+                // running any of the coordinators exit handlers
+                ShardHeader &header = headers[s];
+                try
+                {
+                    for (size_t r = rowBegin; r < rowEnd; ++r)
+                    {
+                        unsigned char *row = results + r * numExpr;
+                        for (size_t e = 0; e < numExpr; ++e)
+                            row[e] = expressions[e].evaluate(valuesVec[r]) ? 1 : 0;
+                    }
+                    header.state = SHARD_DONE;
+                }
+                catch (const std::exception &ex)
+                {
+                    std::strncpy(header.message, ex.what(), sizeof(header.message) - 1);
+                    header.state = SHARD_FAILED;
+                }
+                catch (...)
+                {
+                    header.state = SHARD_FAILED;
+                }
+                _exit(0);
+            }
+            else if (pid < 0)
+            {
+                // could not fork, do this shard in the coordinator
+                // once the others are collected
+                workers.push_back(0);
+            }
+            else
+                workers.push_back(pid);
+        }
+
+        std::string error;
+        for (unsigned int s = 0; s < numShards; ++s)
+        {
+            ShardHeader &header = headers[s];
+            if (workers[s] == 0)
+            {
+                const size_t rowBegin = numRows * s / numShards;
+                const size_t rowEnd = numRows * (s + 1) / numShards;
+                try
+                {
+                    for (size_t r = rowBegin; r < rowEnd; ++r)
+                        for (size_t e = 0; e < numExpr; ++e)
+                            results[r * numExpr + e] = expressions[e].evaluate(valuesVec[r]) ? 1 : 0;
+                    header.state = SHARD_DONE;
+                }
+                catch (const std::exception &ex)
+                {
+                    std::strncpy(header.message, ex.what(), sizeof(header.message) - 1);
+                    header.state = SHARD_FAILED;
+                }
+                catch (...)
+                {
+                    header.state = SHARD_FAILED;
+                }
+            }
+            else
+            {
+                int status = 0;
+                if (!sharding::waitWorker(workers[s], status, timeoutMs != 0, deadline) && error.empty())
+                    error = "Shard " + std::to_string(s) + " timed out after " + std::to_string(timeoutMs) + " ms.";
+                else if (WIFSIGNALED(status) && error.empty())
+                    error = "Shard " + std::to_string(s) + " terminated by signal " + std::to_string(WTERMSIG(status)) + ".";
+            }
+
+            if (header.state != SHARD_DONE && error.empty())
+            {
+                error = "Shard " + std::to_string(s) + " failed";
+                error += header.message[0] ? ": " + std::string(header.message) : ".";
+            }
+        }
+
+        if (!error.empty())
+        {
+            munmap(mapping, mapSize);
+            throw(std::runtime_error(error));
+        }
+
+        // merge the shards in row order
+        std::vector<std::vector<bool>> evalVec(numRows, std::vector<bool>(numExpr));
+        for (size_t r = 0; r < numRows; ++r)
+            for (size_t e = 0; e < numExpr; ++e)
+                evalVec[r][e] = results[r * numExpr + e] != 0;
+
+        munmap(mapping, mapSize);
+        return evalVec;
+#endif
+    }
+
+}
@@ -0,0 +1,224 @@
+// -----------------------------------------------------------
+// SparseBatch and SparseEvaluator classes
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// evaluation of logical expressions for wide but mostly zero
+// vectors. the vectors are stored as index/value pairs in a
+// compressed sparse row batch, missing entries are zero.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "LogicalExpression.h"
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace tc
+{
+
+    // -----------------------------------------------------------
+    // a batch of sparse vectors in compressed sparse row format
+    // -----------------------------------------------------------
+    template <typename T>
+    class SparseBatch final
+    {
+    private:
+        std::vector<size_t> m_rowOffsets;
+        std::vector<size_t> m_indices;
+        std::vector<T> m_values;
+
+    public:
+        SparseBatch() : m_rowOffsets(1, 0) {}
+        ~SparseBatch() {}
+
+        void reserve(size_t numRows, size_t numEntries)
+        {
+            m_rowOffsets.reserve(numRows + 1);
+            m_indices.reserve(numEntries);
+            m_values.reserve(numEntries);
+        }
+
+        void addRow(const std::vector<std::pair<size_t, T>> &entries)
+        {
+            for (auto & e : entries)
+            {
+                m_indices.push_back(e.first);
+                m_values.push_back(e.second);
+            }
+            m_rowOffsets.push_back(m_indices.size());
+        }
+
+        void addRow(const std::vector<size_t> &indices, const std::vector<T> &values)
+        {
+            if (indices.size() != values.size())
+                throw(std::invalid_argument("Number of indices and values of a sparse row differ."));
+
+            m_indices.insert(m_indices.end(), indices.begin(), indices.end());
+            m_values.insert(m_values.end(), values.begin(), values.end());
+            m_rowOffsets.push_back(m_indices.size());
+        }
+
+        void clear()
+        {
+            m_rowOffsets.resize(1);
+            m_indices.clear();
+            m_values.clear();
+        }
+
+        size_t size() const { return m_rowOffsets.size() - 1; }
+        size_t numEntries() const { return m_indices.size(); }
+
+        // entries of row r are [rowBegin(r), rowEnd(r))
+        size_t rowBegin(size_t r) const { return m_rowOffsets[r]; }
+        size_t rowEnd(size_t r) const { return m_rowOffsets[r + 1]; }
+        size_t index(size_t e) const { return m_indices[e]; }
+        const T& value(size_t e) const { return m_values[e]; }
+    };
+
+
+    // -----------------------------------------------------------
+    // evaluates a bunch of expressions for sparse vectors.
+    // the variables used by the expressions are scattered into
+    // a dense scratch vector, which reaches up to the highest
+    // used index and is reset after every row. expressions whose
+    // variables are all missing in a row get the result for the
+    // zero vector, which is computed once up front.
+    // -----------------------------------------------------------
+    template <typename T>
+    class SparseEvaluator final
+    {
+    public:
+        // -----------------------------------------------------------
+        // the scratch buffers of the evaluation. keep one per thread
+        // and pass it to every call, so single rows do not allocate
+        // and clear a dense vector each. not to be shared between
+        // threads, it may be used with different evaluators
+        // -----------------------------------------------------------
+        class Workspace final
+        {
+            friend class SparseEvaluator < T > ;
+
+        private:
+            std::vector<T> m_scratch;
+            // row stamp per expression, marks the ones to evaluate
+            std::vector<size_t> m_stamps;
+            std::vector<size_t> m_dirty;
+            size_t m_stamp;
+
+        public:
+            Workspace() : m_stamp(0) {}
+            ~Workspace() {}
+        };
+
+    private:
+        std::vector<LogicalExpression<T>> m_expressions;
+        // the expressions depending on each variable index
+        std::vector<std::vector<size_t>> m_dependents;
+        std::vector<bool> m_zeroResults;
+
+    public:
+        explicit SparseEvaluator(std::vector<LogicalExpression<T>> expressions) :
+            m_expressions(std::move(expressions))
+        {
+            for (size_t e = 0; e < m_expressions.size(); ++e)
+            {
+                for (auto idx : m_expressions[e].variables())
+                {
+                    if (idx >= m_dependents.size())
+                        m_dependents.resize(idx + 1);
+                    m_dependents[idx].push_back(e);
+                }
+            }
+
+            std::vector<T> zeros(m_dependents.size(), T());
+            m_zeroResults = tc::evaluate(zeros, m_expressions);
+        }
+        ~SparseEvaluator() {}
+
+        size_t size() const { return m_expressions.size(); }
+
+        std::vector<bool> evaluate(const std::vector<std::pair<size_t, T>> &entries, Workspace &workspace) const
+        {
+            prepare(workspace);
+
+            std::vector<bool> eval(m_zeroResults);
+            evaluateRow(entries.size(), [&entries](size_t i) { return entries[i].first; },
+                [&entries](size_t i) { return entries[i].second; }, workspace, eval);
+
+            return eval;
+        }
+
+        std::vector<std::vector<bool>> evaluate(const SparseBatch<T> &batch) const
+        {
+            Workspace workspace;
+            return evaluate(batch, workspace);
+        }
+
+        std::vector<std::vector<bool>> evaluate(const SparseBatch<T> &batch, Workspace &workspace) const
+        {
+            prepare(workspace);
+
+            std::vector<std::vector<bool>> evalVec(batch.size(), m_zeroResults);
+            for (size_t r = 0; r < batch.size(); ++r)
+            {
+                const size_t begin = batch.rowBegin(r);
+                evaluateRow(batch.rowEnd(r) - begin, [&batch, begin](size_t i) { return batch.index(begin + i); },
+                    [&batch, begin](size_t i) { return batch.value(begin + i); }, workspace, evalVec[r]);
+            }
+
+            return evalVec;
+        }
+
+    private:
+        SparseEvaluator() = delete;
+
+        void prepare(Workspace &workspace) const
+        {
+            if (workspace.m_scratch.size() < m_dependents.size())
+                workspace.m_scratch.resize(m_dependents.size(), T());
+            if (workspace.m_stamps.size() < m_expressions.size())
+                workspace.m_stamps.resize(m_expressions.size(), 0);
+        }
+
+        // -----------------------------------------------------------
+        // evaluate the expressions depending on the n entries of a
+        // row, eval holds the results for the zero vector. stamps
+        // only grow, so the marks of earlier rows never match
+        // -----------------------------------------------------------
+        template <typename Index, typename Value>
+        void evaluateRow(size_t n, Index index, Value value, Workspace &workspace, std::vector<bool> &eval) const
+        {
+            std::vector<T> &scratch = workspace.m_scratch;
+            const size_t stamp = ++workspace.m_stamp;
+
+            workspace.m_dirty.clear();
+            for (size_t i = 0; i < n; ++i)
+            {
+                const size_t idx = index(i);
+                if (idx >= m_dependents.size())
+                    continue;
+
+                scratch[idx] = value(i);
+                for (auto e : m_dependents[idx])
+                {
+                    if (workspace.m_stamps[e] != stamp)
+                    {
+                        workspace.m_stamps[e] = stamp;
+                        workspace.m_dirty.push_back(e);
+                    }
+                }
+            }
+
+            for (auto e : workspace.m_dirty)
+                eval[e] = m_expressions[e].evaluate(scratch);
+
+            for (size_t i = 0; i < n; ++i)
+                if (index(i) < m_dependents.size())
+                    scratch[index(i)] = T();
+        }
+    };
+
+}
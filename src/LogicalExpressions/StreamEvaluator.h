@@ -0,0 +1,124 @@
+// -----------------------------------------------------------
+// StreamEvaluator class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// evaluation of logical expressions for a stream of vectors
+// that never has to be in memory as a whole. the vectors are
+// pulled from a source in chunks of fixed size and the results
+// of each chunk are pushed to a sink. the chunk buffers are
+// reused, so memory stays the same no matter how long the
+// stream is.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "LogicalExpression.h"
+
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace tc
+{
+
+    template <typename T>
+    class StreamEvaluator final
+    {
+    public:
+        // -----------------------------------------------------------
+        // a source writes the next vector into the given one and
+        // returns false once the stream has ended. the vector still
+        // holds the one the slot had a chunk ago, assigning to it
+        // reuses its memory
+        // -----------------------------------------------------------
+        typedef std::function<bool(std::vector<T>&)> Source;
+
+        // -----------------------------------------------------------
+        // a sink receives the index of the first vector of a chunk
+        // and one result per expression for every vector of it. the
+        // results are only valid during the call
+        // -----------------------------------------------------------
+        typedef std::function<void(size_t, const std::vector<std::vector<bool>>&)> Sink;
+
+    private:
+        std::vector<LogicalExpression<T>> m_expressions;
+        size_t m_chunkSize;
+        std::vector<std::vector<T>> m_chunk;
+        std::vector<std::vector<bool>> m_results;
+
+    public:
+        explicit StreamEvaluator(std::vector<LogicalExpression<T>> expressions, size_t chunkSize = 4096) :
+            m_expressions(std::move(expressions)), m_chunkSize(chunkSize)
+        {
+            if (m_chunkSize == 0)
+                throw(std::invalid_argument("Chunk size of a stream must not be zero."));
+        }
+        ~StreamEvaluator() {}
+
+        size_t size() const { return m_expressions.size(); }
+        size_t chunkSize() const { return m_chunkSize; }
+
+        // -----------------------------------------------------------
+        // evaluate all vectors of a source, returns their number
+        // -----------------------------------------------------------
+        size_t run(const Source &source, const Sink &sink)
+        {
+            m_chunk.resize(m_chunkSize);
+            m_results.resize(m_chunkSize, std::vector<bool>(m_expressions.size()));
+
+            size_t numRows = 0;
+            for (bool more = true; more;)
+            {
+                size_t n = 0;
+                while (n < m_chunkSize && (more = source(m_chunk[n])))
+                    ++n;
+
+                if (n == 0)
+                    break;
+
+                // only the last chunk can be shorter, the sink sees
+                // exactly the vectors it holds
+                if (n < m_chunkSize)
+                    m_results.resize(n);
+
+                evaluateChunk(n);
+                sink(numRows, m_results);
+                numRows += n;
+            }
+
+            return numRows;
+        }
+
+        // -----------------------------------------------------------
+        // evaluate a range of vectors, e.g. of a container or an
+        // input stream, without holding more than one chunk
+        // -----------------------------------------------------------
+        template <typename InputIt>
+        size_t run(InputIt first, InputIt last, const Sink &sink)
+        {
+            return run([&first, &last](std::vector<T> &values) {
+                if (first == last)
+                    return false;
+                // iterators of generators yield rows by value
+                auto &&row = *first;
+                values.assign(std::begin(row), std::end(row));
+                ++first;
+                return true;
+            }, sink);
+        }
+
+    private:
+        StreamEvaluator() = delete;
+
+        void evaluateChunk(size_t n)
+        {
+            for (size_t r = 0; r < n; ++r)
+                for (size_t e = 0; e < m_expressions.size(); ++e)
+                    m_results[r][e] = m_expressions[e].evaluate(m_chunk[r]);
+        }
+    };
+
+}
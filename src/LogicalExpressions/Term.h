@@ -11,6 +11,10 @@
 
 #include "TermBehavior.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
+
 namespace tc
 {
     // -----------------------------------------------------------
@@ -19,6 +23,13 @@ namespace tc
     template <typename T> class LogicalExpression;
 
 
+    // number of vectors a term substitutes at once in a batch
+    const size_t SUBSTITUTION_BLOCK = 256;
+
+    // terms deeper than this are substituted without recursion
+    const size_t RECURSION_DEPTH = 512;
+
+
     // -----------------------------------------------------------
     // term class that wraps a terms behavior
     // offers the possibility to substitute the values of a vector
@@ -32,89 +43,308 @@ namespace tc
 
     public:
         Term(Term<T> a, Term<T> b, std::function<T(T, T)> f) :
-            m_termBehavior(std::shared_ptr<CombinedTermBehavior<T>>(new CombinedTermBehavior<T>(a.getBehavior(), b.getBehavior(), f))) {}
+            m_termBehavior(std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), std::move(a.m_termBehavior), std::move(b.m_termBehavior), std::move(f))) {}
         Term(Term<T> a, std::function<T(T)> f) :
-            m_termBehavior(std::shared_ptr<ModifiedTermBehavior<T>>(new ModifiedTermBehavior<T>(a.getBehavior(), f))) {}
+            m_termBehavior(std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(a.m_termBehavior), std::move(f))) {}
+        // built-in operations, see TermOperations.h
+        Term(Term<T> a, TERM_OP op) :
+            m_termBehavior(std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(a.m_termBehavior), checkOperation(op, true), T())) {}
+        Term(Term<T> a, TERM_OP op, T val) :
+            m_termBehavior(std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(a.m_termBehavior), checkOperation(op, false), val)) {}
+        Term(Term<T> a, TERM_OP op, Term<T> b) :
+            m_termBehavior(std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), std::move(a.m_termBehavior), std::move(b.m_termBehavior), checkOperation(op, false))) {}
+        // the destructor would suppress the implicit move operations,
+        // so spell them out to avoid reference count traffic
+        Term(const Term<T> &other) : m_termBehavior(other.m_termBehavior) {}
+        Term(Term<T> &&other) : m_termBehavior(std::move(other.m_termBehavior)) {}
+        Term<T>& operator=(const Term<T> &other)
+        {
+            m_termBehavior = other.m_termBehavior;
+            return *this;
+        }
+        Term<T>& operator=(Term<T> &&other)
+        {
+            m_termBehavior = std::move(other.m_termBehavior);
+            return *this;
+        }
         ~Term() {}
 
         static Term<T> CreateConstTerm(T val)
         {
-            return Term<T>(std::shared_ptr<ConstTermBehavior<T>>(new ConstTermBehavior<T>(val)));
+            return Term<T>(std::make_shared<ConstTermBehavior<T>>(BehaviorKey<T>(), val));
         }
 
         static Term<T> CreateVariableTerm(unsigned int idx)
         {
-            return Term<T>(std::shared_ptr<VariableTermBehavior<T>>(new VariableTermBehavior<T>(idx)));
+            return Term<T>(std::make_shared<VariableTermBehavior<T>>(BehaviorKey<T>(), idx));
         }
 
         T substitute(const std::vector<T> &values) const
         {
+            if (m_termBehavior->m_nDepth > RECURSION_DEPTH)
+                return m_termBehavior->substituteIterative(values);
             return m_termBehavior->substitute(values);
         }
 
         std::vector<T> substitute(const std::vector<std::vector<T>> &valuesVec) const
         {
-            std::vector<T> substVec;
-            for (auto & values : valuesVec)
-                substVec.push_back(m_termBehavior->substitute(values));
+            // blocks keep the intermediate columns of the operations in
+            // the cache while the built-in ones run as vectorized loops
+            std::vector<T> substVec(valuesVec.size());
+            std::vector<std::vector<T>> columns;
+            for (size_t r = 0; r < valuesVec.size(); r += SUBSTITUTION_BLOCK)
+            {
+                const size_t n = std::min(SUBSTITUTION_BLOCK, valuesVec.size() - r);
+                if (m_termBehavior->m_nDepth > RECURSION_DEPTH)
+                    m_termBehavior->substituteIterative(valuesVec.data() + r, n, substVec.data() + r, columns);
+                else
+                    m_termBehavior->substitute(valuesVec.data() + r, n, substVec.data() + r, columns, 0);
+            }
 
             return substVec;
         }
 
+        // -----------------------------------------------------------
+        // sorted indices of all variables the term depends on
+        // -----------------------------------------------------------
+        std::vector<size_t> variables() const
+        {
+            // shared operands are visited once
+            std::vector<size_t> indices;
+            std::set<const TermBehavior<T>*> visited;
+            std::vector<const TermBehavior<T>*> todo(1, m_termBehavior.get());
+            while (!todo.empty())
+            {
+                const TermBehavior<T> *node = todo.back();
+                todo.pop_back();
+                if (!visited.insert(node).second)
+                    continue;
+
+                node->collectVariables(indices);
+                const TermBehavior<T> *ops[2];
+                for (size_t i = node->operands(ops); i > 0; --i)
+                    todo.push_back(ops[i - 1]);
+            }
+            std::sort(indices.begin(), indices.end());
+            indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+            return indices;
+        }
+
+        // -----------------------------------------------------------
+        // the same term with chains of + and * (e.g. built by += in
+        // a loop) turned into balanced trees, so their depth grows
+        // logarithmically and independent operations can overlap.
+        // constant operands of a chain are folded into one.
+        // note: for floating point types the sums and products are
+        // computed in a different order, so the results may differ
+        // by rounding
+        // -----------------------------------------------------------
+        Term<T> rebalanced() const
+        {
+            typedef std::shared_ptr<TermBehavior<T>> Behavior;
+
+            // post-order walk, chains are handled as a whole by their
+            // topmost node and every other node is rebuilt on top of
+            // its rebuilt operands
+            std::map<const TermBehavior<T>*, Behavior> rebuilt;
+            std::vector<std::pair<Behavior, bool>> todo(1, std::make_pair(m_termBehavior, false));
+            while (!todo.empty())
+            {
+                const Behavior node = todo.back().first;
+                const bool expanded = todo.back().second;
+                if (rebuilt.count(node.get()))
+                {
+                    todo.pop_back();
+                    continue;
+                }
+
+                const TERM_OP op = chainOperation(*node);
+                std::vector<Behavior> operands;
+                std::vector<T> constants;
+                if (op != OP_CUSTOM)
+                    collectChain(node, op, operands, constants);
+                else if (auto mtb = dynamic_cast<const ModifiedTermBehavior<T>*>(node.get()))
+                    operands.push_back(mtb->m_term);
+                else if (auto ctb = dynamic_cast<const CombinedTermBehavior<T>*>(node.get()))
+                {
+                    operands.push_back(ctb->m_term1);
+                    operands.push_back(ctb->m_term2);
+                }
+
+                if (!expanded)
+                {
+                    todo.back().second = true;
+                    for (size_t i = operands.size(); i > 0; --i)
+                        if (!rebuilt.count(operands[i - 1].get()))
+                            todo.push_back(std::make_pair(operands[i - 1], false));
+                    continue;
+                }
+                todo.pop_back();
+
+                for (auto & o : operands)
+                    o = rebuilt[o.get()];
+
+                if (op != OP_CUSTOM)
+                    rebuilt[node.get()] = balance(op, std::move(operands), constants);
+                else if (auto mtb = dynamic_cast<const ModifiedTermBehavior<T>*>(node.get()))
+                {
+                    if (operands[0] == mtb->m_term)
+                        rebuilt[node.get()] = node;
+                    else if (mtb->m_op == OP_CUSTOM)
+                        rebuilt[node.get()] = std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), operands[0], mtb->m_modifier);
+                    else
+                        rebuilt[node.get()] = std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), operands[0], mtb->m_op, mtb->m_const);
+                }
+                else if (auto ctb = dynamic_cast<const CombinedTermBehavior<T>*>(node.get()))
+                {
+                    if (operands[0] == ctb->m_term1 && operands[1] == ctb->m_term2)
+                        rebuilt[node.get()] = node;
+                    else if (ctb->m_op == OP_CUSTOM)
+                        rebuilt[node.get()] = std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), operands[0], operands[1], ctb->m_combiner);
+                    else
+                        rebuilt[node.get()] = std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), operands[0], operands[1], ctb->m_op);
+                }
+                else
+                    rebuilt[node.get()] = node;
+            }
+
+            return Term<T>(rebuilt[m_termBehavior.get()]);
+        }
+
         // various assignment operators
-        Term<T>& operator+=(const Term<T> &rhs)
+        Term<T>& operator+=(Term<T> rhs)
         {
-            m_termBehavior = std::shared_ptr<CombinedTermBehavior<T>>(new CombinedTermBehavior<T>(m_termBehavior, rhs.getBehavior(), std::plus<T>()));
+            m_termBehavior = std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), std::move(rhs.m_termBehavior), OP_ADD);
             return *this;
         }
 
         Term<T>& operator+=(const T &val)
         {
-            m_termBehavior = std::shared_ptr<ModifiedTermBehavior<T>>(new ModifiedTermBehavior<T>(m_termBehavior, [val](const T &a) { return a + val; }));
+            m_termBehavior = std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), OP_ADD, val);
             return *this;
         }
 
-        Term<T>& operator-=(const Term<T> &rhs)
+        Term<T>& operator-=(Term<T> rhs)
         {
-            m_termBehavior = std::shared_ptr<CombinedTermBehavior<T>>(new CombinedTermBehavior<T>(m_termBehavior, rhs.getBehavior(), std::minus<T>()));
+            m_termBehavior = std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), std::move(rhs.m_termBehavior), OP_SUB);
             return *this;
         }
 
         Term<T>& operator-=(const T &val)
         {
-            m_termBehavior = std::shared_ptr<ModifiedTermBehavior<T>>(new ModifiedTermBehavior<T>(m_termBehavior, [val](const T &a) { return a - val; }));
+            m_termBehavior = std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), OP_SUB, val);
             return *this;
         }
 
-        Term<T>& operator*=(const Term<T> &rhs)
+        Term<T>& operator*=(Term<T> rhs)
         {
-            m_termBehavior = std::shared_ptr<CombinedTermBehavior<T>>(new CombinedTermBehavior<T>(m_termBehavior, rhs.getBehavior(), std::multiplies<T>()));
+            m_termBehavior = std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), std::move(rhs.m_termBehavior), OP_MUL);
             return *this;
         }
 
         Term<T>& operator*=(const T &val)
         {
-            m_termBehavior = std::shared_ptr<ModifiedTermBehavior<T>>(new ModifiedTermBehavior<T>(m_termBehavior, [val](const T &a) { return a * val; }));
+            m_termBehavior = std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), OP_MUL, val);
             return *this;
         }
 
-        Term<T>& operator/=(const Term<T> &rhs)
+        Term<T>& operator/=(Term<T> rhs)
         {
-            m_termBehavior = std::shared_ptr<CombinedTermBehavior<T>>(new CombinedTermBehavior<T>(m_termBehavior, rhs.getBehavior(), std::divides<T>()));
+            m_termBehavior = std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), std::move(rhs.m_termBehavior), OP_DIV);
             return *this;
         }
 
         Term<T>& operator/=(const T &val)
         {
-            m_termBehavior = std::shared_ptr<ModifiedTermBehavior<T>>(new ModifiedTermBehavior<T>(m_termBehavior, [val](const T &a) { return a / val; }));
+            m_termBehavior = std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(m_termBehavior), OP_DIV, val);
             return *this;
         }
 
     private:
+        friend class Inspection < T > ;
+
         Term() = delete;
-        Term(std::shared_ptr<TermBehavior<T>> tb) : m_termBehavior(tb) {}
+
+        static TERM_OP checkOperation(TERM_OP op, bool unary)
+        {
+            if (op == OP_CUSTOM || isUnaryOperation(op) != unary)
+                throw(std::invalid_argument(unary ? "Term operation is not unary." : "Term operation is not binary."));
+            return op;
+        }
+        Term(std::shared_ptr<TermBehavior<T>> tb) : m_termBehavior(std::move(tb)) {}
 
         std::shared_ptr<TermBehavior<T>> getBehavior() const { return m_termBehavior; }
+
+        // OP_ADD or OP_MUL if the node is a link of such a chain
+        static TERM_OP chainOperation(const TermBehavior<T> &tb)
+        {
+            TERM_OP op = OP_CUSTOM;
+            if (auto mtb = dynamic_cast<const ModifiedTermBehavior<T>*>(&tb))
+                op = mtb->m_op;
+            else if (auto ctb = dynamic_cast<const CombinedTermBehavior<T>*>(&tb))
+                op = ctb->m_op;
+
+            return op == OP_ADD || op == OP_MUL ? op : OP_CUSTOM;
+        }
+
+        // -----------------------------------------------------------
+        // the operands of a chain from left to right. links used by
+        // other terms as well end the chain, so shared parts are not
+        // duplicated
+        // -----------------------------------------------------------
+        static void collectChain(const std::shared_ptr<TermBehavior<T>> &root, TERM_OP op,
+            std::vector<std::shared_ptr<TermBehavior<T>>> &operands, std::vector<T> &constants)
+        {
+            std::vector<const std::shared_ptr<TermBehavior<T>>*> todo(1, &root);
+            while (!todo.empty())
+            {
+                const std::shared_ptr<TermBehavior<T>> &node = *todo.back();
+                todo.pop_back();
+
+                if (&node != &root && (node.use_count() != 1 || chainOperation(*node) != op))
+                    operands.push_back(node);
+                else if (auto mtb = dynamic_cast<const ModifiedTermBehavior<T>*>(node.get()))
+                {
+                    constants.push_back(mtb->m_const);
+                    todo.push_back(&mtb->m_term);
+                }
+                else if (auto ctb = dynamic_cast<const CombinedTermBehavior<T>*>(node.get()))
+                {
+                    todo.push_back(&ctb->m_term2);
+                    todo.push_back(&ctb->m_term1);
+                }
+            }
+        }
+
+        // -----------------------------------------------------------
+        // combine the operands pairwise, level by level
+        // -----------------------------------------------------------
+        static std::shared_ptr<TermBehavior<T>> balance(TERM_OP op,
+            std::vector<std::shared_ptr<TermBehavior<T>>> level, const std::vector<T> &constants)
+        {
+            while (level.size() > 1)
+            {
+                std::vector<std::shared_ptr<TermBehavior<T>>> next;
+                next.reserve((level.size() + 1) / 2);
+                for (size_t i = 0; i + 1 < level.size(); i += 2)
+                    next.push_back(std::make_shared<CombinedTermBehavior<T>>(BehaviorKey<T>(), std::move(level[i]), std::move(level[i + 1]), op));
+                if (level.size() & 1)
+                    next.push_back(std::move(level.back()));
+                level.swap(next);
+            }
+
+            if (constants.empty())
+                return level.front();
+
+            T val = constants.front();
+            for (size_t i = 1; i < constants.size(); ++i)
+                val = applyOperation(op, val, constants[i]);
+
+            if (level.empty())
+                return std::make_shared<ConstTermBehavior<T>>(BehaviorKey<T>(), val);
+            return std::make_shared<ModifiedTermBehavior<T>>(BehaviorKey<T>(), std::move(level.front()), op, val);
+        }
     };
 
 
@@ -122,7 +352,7 @@ namespace tc
     // substitute a bunch of terms for one vector at once
     // -----------------------------------------------------------
     template <typename T>
-    std::vector<T> substitute(std::vector<T> values, std::vector<Term<T>> terms)
+    std::vector<T> substitute(const std::vector<T> &values, const std::vector<Term<T>> &terms)
     {
         std::vector<T> substVec;
         for (auto & t : terms)
@@ -138,9 +368,15 @@ namespace tc
     std::vector<std::vector<T>> substitute(const std::vector<std::vector<T>> &valuesVec,
         const std::vector<Term<T>> &terms)
     {
-        std::vector<std::vector<T>> substVec;
-        for (auto & values : valuesVec)
-            substVec.push_back(substitute(values, terms));
+        // work term by term on columns, so the built-in operations
+        // run as vectorized loops
+        std::vector<std::vector<T>> substVec(valuesVec.size(), std::vector<T>(terms.size()));
+        for (size_t t = 0; t < terms.size(); ++t)
+        {
+            std::vector<T> column = terms[t].substitute(valuesVec);
+            for (size_t r = 0; r < valuesVec.size(); ++r)
+                substVec[r][t] = column[r];
+        }
 
         return substVec;
     }
@@ -155,100 +391,175 @@ namespace tc
     // sign of a term
     // -----------------------------------------------------------
     template <typename T>
-    Term<T> operator+(const Term<T> &a)
+    Term<T> operator+(Term<T> a)
     {
         return a;
     }
 
     template <typename T>
-    Term<T> operator-(const Term<T> &a)
+    Term<T> operator-(Term<T> a)
     {
-        return Term<T>(a, [](const T &a) { return -a; });
+        return Term<T>(std::move(a), OP_NEG);
     }
 
     // -----------------------------------------------------------
     // addition of two terms, or a term and a constant
     // -----------------------------------------------------------
     template <typename T>
-    Term<T> operator+(const Term<T> &a, const Term<T> &b)
+    Term<T> operator+(Term<T> a, Term<T> b)
     {
-        return Term<T>(a, b, std::plus<T>());
+        return Term<T>(std::move(a), OP_ADD, std::move(b));
     }
 
     template <typename T>
-    Term<T> operator+(const Term<T> &a, const T &val)
+    Term<T> operator+(Term<T> a, const T &val)
     {
-        return Term<T>(a, [val](const T &a) { return a + val; });
+        return Term<T>(std::move(a), OP_ADD, val);
     }
 
     template <typename T>
-    Term<T> operator+(const T &val, const Term<T> &b)
+    Term<T> operator+(const T &val, Term<T> b)
     {
-        return Term<T>(b, [val](const T &b) { return val + b; });
+        return Term<T>(std::move(b), OP_ADD, val);
     }
 
     // -----------------------------------------------------------
     // subtraction of two terms, or a term and a constant
     // -----------------------------------------------------------
     template <typename T>
-    Term<T> operator-(const Term<T> &a, const Term<T> &b)
+    Term<T> operator-(Term<T> a, Term<T> b)
     {
-        return Term<T>(a, b, std::minus<T>());
+        return Term<T>(std::move(a), OP_SUB, std::move(b));
     }
 
     template <typename T>
-    Term<T> operator-(const Term<T> &a, const T &val)
+    Term<T> operator-(Term<T> a, const T &val)
     {
-        return Term<T>(a, [val](const T &a) { return a - val; });
+        return Term<T>(std::move(a), OP_SUB, val);
     }
 
     template <typename T>
-    Term<T> operator-(const T &val, const Term<T> &b)
+    Term<T> operator-(const T &val, Term<T> b)
     {
 
-        return Term<T>(b, [val](const T &b) { return val - b; });
+        return Term<T>(std::move(b), OP_RSUB, val);
     }
 
     // -----------------------------------------------------------
     // multiplication of two terms, or a term and a constant
     // -----------------------------------------------------------
     template <typename T>
-    Term<T> operator*(const Term<T> &a, const Term<T> &b)
+    Term<T> operator*(Term<T> a, Term<T> b)
     {
-        return Term<T>(a, b, std::multiplies<T>());
+        return Term<T>(std::move(a), OP_MUL, std::move(b));
     }
 
     template <typename T>
-    Term<T> operator*(const Term<T> &a, const T &val)
+    Term<T> operator*(Term<T> a, const T &val)
     {
-        return Term<T>(a, [val](const T &a) { return a*val; });
+        return Term<T>(std::move(a), OP_MUL, val);
     }
 
     template <typename T>
-    Term<T> operator*(const T &val, const Term<T> &b)
+    Term<T> operator*(const T &val, Term<T> b)
     {
-        return Term<T>(b, [val](const T &b) { return val * b; });
+        return Term<T>(std::move(b), OP_MUL, val);
     }
 
     // -----------------------------------------------------------
     // division of two terms, or a term and a constant
     // -----------------------------------------------------------
     template <typename T>
-    Term<T> operator/(const Term<T> &a, const Term<T> &b)
+    Term<T> operator/(Term<T> a, Term<T> b)
+    {
+        return Term<T>(std::move(a), OP_DIV, std::move(b));
+    }
+
+    template <typename T>
+    Term<T> operator/(Term<T> a, const T &val)
+    {
+        return Term<T>(std::move(a), OP_DIV, val);
+    }
+
+    template <typename T>
+    Term<T> operator/(const T &val, Term<T> b)
+    {
+        return Term<T>(std::move(b), OP_RDIV, val);
+    }
+
+    // -----------------------------------------------------------
+    // built-in math functions of terms
+    // -----------------------------------------------------------
+    template <typename T>
+    Term<T> abs(Term<T> a)
+    {
+        return Term<T>(std::move(a), OP_ABS);
+    }
+
+    template <typename T>
+    Term<T> sqrt(Term<T> a)
+    {
+        return Term<T>(std::move(a), OP_SQRT);
+    }
+
+    template <typename T>
+    Term<T> exp(Term<T> a)
+    {
+        return Term<T>(std::move(a), OP_EXP);
+    }
+
+    template <typename T>
+    Term<T> log(Term<T> a)
+    {
+        return Term<T>(std::move(a), OP_LOG);
+    }
+
+    template <typename T>
+    Term<T> pow(Term<T> a, Term<T> b)
+    {
+        return Term<T>(std::move(a), OP_POW, std::move(b));
+    }
+
+    template <typename T>
+    Term<T> pow(Term<T> a, const T &val)
+    {
+        return Term<T>(std::move(a), OP_POW, val);
+    }
+
+    template <typename T>
+    Term<T> min(Term<T> a, Term<T> b)
+    {
+        return Term<T>(std::move(a), OP_MIN, std::move(b));
+    }
+
+    template <typename T>
+    Term<T> min(Term<T> a, const T &val)
+    {
+        return Term<T>(std::move(a), OP_MIN, val);
+    }
+
+    template <typename T>
+    Term<T> min(const T &val, Term<T> b)
+    {
+        return Term<T>(std::move(b), OP_MIN, val);
+    }
+
+    template <typename T>
+    Term<T> max(Term<T> a, Term<T> b)
     {
-        return Term<T>(a, b, std::divides<T>());
+        return Term<T>(std::move(a), OP_MAX, std::move(b));
     }
 
     template <typename T>
-    Term<T> operator/(const Term<T> &a, const T &val)
+    Term<T> max(Term<T> a, const T &val)
     {
-        return Term<T>(a, [val](const T &a) { return a / val; });
+        return Term<T>(std::move(a), OP_MAX, val);
     }
 
     template <typename T>
-    Term<T> operator/(const T &val, const Term<T> &b)
+    Term<T> max(const T &val, Term<T> b)
     {
-        return Term<T>(b, [val](const T &b) { return val / b; });
+        return Term<T>(std::move(b), OP_MAX, val);
     }
 
 }
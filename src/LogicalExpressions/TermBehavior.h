@@ -9,10 +9,14 @@
 
 #pragma once
 
+#include "TermOperations.h"
+
 #include <vector>
 #include <memory>
 #include <functional>
 #include <stdexcept>
+#include <utility>
+#include <algorithm>
 
 namespace tc
 {
@@ -20,10 +24,61 @@ namespace tc
     // necessary forward declarations
     // -----------------------------------------------------------
     template <typename T> class Term;
+    template <typename T> class LogicalExpression;
     template <typename T> class ConstTermBehavior;
     template <typename T> class VariableTermBehavior;
     template <typename T> class ModifiedTermBehavior;
     template <typename T> class CombinedTermBehavior;
+    template <typename T> class TermBehavior;
+    template <typename T> class Inspection;
+
+
+    // -----------------------------------------------------------
+    // behaviors are created by std::make_shared, so node and
+    // reference count share one allocation. make_shared needs
+    // public constructors, they take a key only terms and
+    // expressions can create
+    // -----------------------------------------------------------
+    template <typename T>
+    class BehaviorKey final
+    {
+        friend class Term < T > ;
+        friend class LogicalExpression < T > ;
+
+    private:
+        BehaviorKey() {}
+    };
+
+
+    // -----------------------------------------------------------
+    // the kinds of term nodes
+    // -----------------------------------------------------------
+    enum TERM_NODE
+    {
+        TERM_CONST,
+        TERM_VARIABLE,
+        TERM_MODIFIED,
+        TERM_COMBINED
+    };
+
+    // -----------------------------------------------------------
+    // what a single term node computes, for the code compiling or
+    // indexing terms (see Inspection). op is OP_CUSTOM for a user
+    // defined modifier or combiner, value holds the constant of a
+    // constant or modified node. the pointers point into the node
+    // and stay valid as long as it lives
+    // -----------------------------------------------------------
+    template <typename T>
+    struct TermNode
+    {
+        TERM_NODE kind;
+        TERM_OP op;
+        size_t index;
+        T value;
+        const std::function<T(T)> *modifier;
+        const std::function<T(T, T)> *combiner;
+        const TermBehavior<T> *operands[2];
+    };
 
 
     // -----------------------------------------------------------
@@ -35,15 +90,139 @@ namespace tc
         friend class ModifiedTermBehavior < T > ;
         friend class CombinedTermBehavior < T > ;
         friend class Term < T > ;
+        friend class Inspection < T > ;
+
+    private:
+        // length of the longest path down to a leaf, 1 for a leaf
+        size_t m_nDepth;
 
     public:
         virtual ~TermBehavior() {}
 
     protected:
-        TermBehavior() {}
+        TermBehavior(size_t depth = 1) : m_nDepth(depth) {}
 
     private:
         virtual T substitute(const std::vector<T> &values) const = 0;
+        // -----------------------------------------------------------
+        // substitute a block of n vectors at once, one value per
+        // vector. operand values that cannot go to out are kept in
+        // columns[level] and the columns after it, the caller keeps
+        // columns between blocks to save the allocations
+        // -----------------------------------------------------------
+        virtual void substitute(const std::vector<T> *valuesVec, size_t n, T *out,
+            std::vector<std::vector<T>> &columns, size_t level) const = 0;
+        // the variables of this node only, not of its operands
+        virtual void collectVariables(std::vector<size_t> &indices) const = 0;
+        // fill in the fields of the node that apply to its kind
+        virtual void describe(TermNode<T> &node) const = 0;
+
+        // -----------------------------------------------------------
+        // access to the operands for the walks without recursion.
+        // operands returns their number, combine computes the value
+        // of the node from the values of its operands (b is unused
+        // for one operand) and detachOperands hands the operands
+        // over to the caller
+        // -----------------------------------------------------------
+        virtual size_t operands(const TermBehavior<T> * /*ops*/[2]) const { return 0; }
+        virtual T combine(T a, T /*b*/) const { return a; }
+        virtual void combine(T * /*a*/, const T * /*b*/, size_t /*n*/) const {}
+        virtual void detachOperands(std::vector<std::shared_ptr<TermBehavior<T>>> & /*stack*/) {}
+
+        // -----------------------------------------------------------
+        // substitute without recursion, for terms too deep for the
+        // stack. operands are pushed in reverse order, so the values
+        // of the first operands end up below those of the second ones
+        // -----------------------------------------------------------
+        T substituteIterative(const std::vector<T> &values) const
+        {
+            std::vector<std::pair<const TermBehavior<T>*, bool>> todo(1, std::make_pair(this, false));
+            std::vector<T> results;
+            while (!todo.empty())
+            {
+                const TermBehavior<T> *node = todo.back().first;
+                const bool expanded = todo.back().second;
+                todo.pop_back();
+
+                const TermBehavior<T> *ops[2];
+                const size_t numOps = node->operands(ops);
+                if (numOps == 0)
+                    results.push_back(node->substitute(values));
+                else if (!expanded)
+                {
+                    todo.push_back(std::make_pair(node, true));
+                    for (size_t i = numOps; i > 0; --i)
+                        todo.push_back(std::make_pair(ops[i - 1], false));
+                }
+                else
+                {
+                    const T b = numOps == 2 ? results.back() : T();
+                    if (numOps == 2)
+                        results.pop_back();
+                    results.back() = node->combine(results.back(), b);
+                }
+            }
+
+            return results.back();
+        }
+
+        // columns holds the intermediate values, it can be kept
+        // between blocks to save the allocations
+        void substituteIterative(const std::vector<T> *valuesVec, size_t n, T *out,
+            std::vector<std::vector<T>> &columns) const
+        {
+            std::vector<std::pair<const TermBehavior<T>*, bool>> todo(1, std::make_pair(this, false));
+            // the columns below top form a stack of operand values
+            size_t top = 0;
+            while (!todo.empty())
+            {
+                const TermBehavior<T> *node = todo.back().first;
+                const bool expanded = todo.back().second;
+                todo.pop_back();
+
+                const TermBehavior<T> *ops[2];
+                const size_t numOps = node->operands(ops);
+                if (numOps == 0)
+                {
+                    if (top == columns.size())
+                        columns.push_back(std::vector<T>());
+                    if (columns[top].size() < n)
+                        columns[top].resize(n);
+                    node->substitute(valuesVec, n, columns[top].data(), columns, top + 1);
+                    ++top;
+                }
+                else if (!expanded)
+                {
+                    todo.push_back(std::make_pair(node, true));
+                    for (size_t i = numOps; i > 0; --i)
+                        todo.push_back(std::make_pair(ops[i - 1], false));
+                }
+                else
+                {
+                    if (numOps == 2)
+                        --top;
+                    node->combine(columns[top - 1].data(), numOps == 2 ? columns[top].data() : nullptr, n);
+                }
+            }
+
+            std::copy(columns.front().begin(), columns.front().begin() + n, out);
+        }
+
+        // -----------------------------------------------------------
+        // release nodes without recursing into their destructors,
+        // the operands of nodes owned by nobody else are taken over
+        // first so the node dies as a leaf
+        // -----------------------------------------------------------
+        static void release(std::vector<std::shared_ptr<TermBehavior<T>>> &stack)
+        {
+            while (!stack.empty())
+            {
+                std::shared_ptr<TermBehavior<T>> node = std::move(stack.back());
+                stack.pop_back();
+                if (node.use_count() == 1)
+                    node->detachOperands(stack);
+            }
+        }
     };
 
 
@@ -62,12 +241,23 @@ namespace tc
         T m_dConst;
 
     public:
+        ConstTermBehavior(BehaviorKey<T>, T dConstVal) : m_dConst(dConstVal) {}
         virtual ~ConstTermBehavior(void) {}
 
     private:
         ConstTermBehavior() = delete;
-        ConstTermBehavior(T dConstVal) : m_dConst(dConstVal) {}
         virtual T substitute(const std::vector<T> &values) const { return m_dConst; }
+        virtual void substitute(const std::vector<T> * /*valuesVec*/, size_t n, T *out,
+            std::vector<std::vector<T>> & /*columns*/, size_t /*level*/) const
+        {
+            std::fill(out, out + n, m_dConst);
+        }
+        virtual void collectVariables(std::vector<size_t> & /*indices*/) const {}
+        virtual void describe(TermNode<T> &node) const
+        {
+            node.kind = TERM_CONST;
+            node.value = m_dConst;
+        }
     };
 
 
@@ -86,11 +276,11 @@ namespace tc
         size_t m_nIdx;
 
     public:
+        VariableTermBehavior(BehaviorKey<T>, size_t idx) : m_nIdx(idx) {}
         virtual ~VariableTermBehavior(void){}
 
     private:
         VariableTermBehavior() = delete;
-        VariableTermBehavior(size_t idx) : m_nIdx(idx) {}
         virtual T substitute(const std::vector<T> &values) const
         {
             if (m_nIdx < values.size())
@@ -98,10 +288,32 @@ namespace tc
             else
                 throw(std::out_of_range("Index out of bounds for substitution in CTerm."));
         }
+        virtual void substitute(const std::vector<T> *valuesVec, size_t n, T *out,
+            std::vector<std::vector<T>> & /*columns*/, size_t /*level*/) const
+        {
+            for (size_t r = 0; r < n; ++r)
+            {
+                if (m_nIdx < valuesVec[r].size())
+                    out[r] = valuesVec[r][m_nIdx];
+                else
+                    throw(std::out_of_range("Index out of bounds for substitution in CTerm."));
+            }
+        }
+        virtual void collectVariables(std::vector<size_t> &indices) const
+        {
+            indices.push_back(m_nIdx);
+        }
+        virtual void describe(TermNode<T> &node) const
+        {
+            node.kind = TERM_VARIABLE;
+            node.index = m_nIdx;
+        }
     };
 
     // -----------------------------------------------------------
     // modified term behavior (e.g. 3*term)
+    // either a built-in operation with a constant operand or a
+    // user defined modifier
     // -----------------------------------------------------------
     template <typename T>
     class ModifiedTermBehavior :
@@ -113,23 +325,77 @@ namespace tc
     private:
         std::shared_ptr<TermBehavior<T>> m_term;
         std::function<T(T)> m_modifier;
+        TERM_OP m_op;
+        T m_const;
 
     public:
-        virtual ~ModifiedTermBehavior(void){}
+        ModifiedTermBehavior(BehaviorKey<T>, std::shared_ptr<TermBehavior<T>> t, std::function<T(T)> f) :
+            TermBehavior<T>(t->m_nDepth + 1), m_term(std::move(t)), m_modifier(std::move(f)), m_op(OP_CUSTOM), m_const() {}
+        ModifiedTermBehavior(BehaviorKey<T>, std::shared_ptr<TermBehavior<T>> t, TERM_OP op, T val) :
+            TermBehavior<T>(t->m_nDepth + 1), m_term(std::move(t)), m_op(op), m_const(val) {}
+        virtual ~ModifiedTermBehavior(void)
+        {
+            // chains of thousands of nodes would overflow the stack
+            if (m_term.use_count() == 1)
+            {
+                std::vector<std::shared_ptr<TermBehavior<T>>> stack;
+                stack.push_back(std::move(m_term));
+                TermBehavior<T>::release(stack);
+            }
+        }
 
     private:
         ModifiedTermBehavior() = delete;
-        ModifiedTermBehavior(std::shared_ptr<TermBehavior<T>> t, std::function<T(T)> f) :
-            m_term(t), m_modifier(f) {}
         virtual T substitute(const std::vector<T> &values) const
         {
-            return m_modifier(m_term->substitute(values));
+            return combine(m_term->substitute(values), T());
+        }
+        virtual void substitute(const std::vector<T> *valuesVec, size_t n, T *out,
+            std::vector<std::vector<T>> &columns, size_t level) const
+        {
+            m_term->substitute(valuesVec, n, out, columns, level);
+            combine(out, nullptr, n);
+        }
+        virtual void collectVariables(std::vector<size_t> & /*indices*/) const {}
+        virtual void describe(TermNode<T> &node) const
+        {
+            node.kind = TERM_MODIFIED;
+            node.op = m_op;
+            node.value = m_const;
+            node.modifier = &m_modifier;
+            node.operands[0] = m_term.get();
+        }
+        virtual size_t operands(const TermBehavior<T> *ops[2]) const
+        {
+            ops[0] = m_term.get();
+            return 1;
+        }
+        virtual T combine(T a, T /*b*/) const
+        {
+            if (m_op == OP_CUSTOM)
+                return m_modifier(a);
+            return applyOperation(m_op, a, m_const);
+        }
+        virtual void combine(T *a, const T * /*b*/, size_t n) const
+        {
+            if (m_op == OP_CUSTOM)
+            {
+                for (size_t r = 0; r < n; ++r)
+                    a[r] = m_modifier(a[r]);
+            }
+            else
+                applyOperation(m_op, a, m_const, n);
+        }
+        virtual void detachOperands(std::vector<std::shared_ptr<TermBehavior<T>>> &stack)
+        {
+            stack.push_back(std::move(m_term));
         }
     };
 
 
     // -----------------------------------------------------------
     // combined term behavior (e.g. term1+term2)
+    // either a built-in operation or a user defined combiner
     // -----------------------------------------------------------
     template <typename T>
     class CombinedTermBehavior :
@@ -142,17 +408,82 @@ namespace tc
         std::shared_ptr<TermBehavior<T>> m_term1;
         std::shared_ptr<TermBehavior<T>> m_term2;
         std::function<T(T, T)> m_combiner;
+        TERM_OP m_op;
 
     public:
-        virtual ~CombinedTermBehavior(void){}
+        CombinedTermBehavior(BehaviorKey<T>, std::shared_ptr<TermBehavior<T>> t1, std::shared_ptr<TermBehavior<T>> t2, std::function<T(T, T)> f) :
+            TermBehavior<T>(std::max(t1->m_nDepth, t2->m_nDepth) + 1),
+            m_term1(std::move(t1)), m_term2(std::move(t2)), m_combiner(std::move(f)), m_op(OP_CUSTOM) {}
+        CombinedTermBehavior(BehaviorKey<T>, std::shared_ptr<TermBehavior<T>> t1, std::shared_ptr<TermBehavior<T>> t2, TERM_OP op) :
+            TermBehavior<T>(std::max(t1->m_nDepth, t2->m_nDepth) + 1),
+            m_term1(std::move(t1)), m_term2(std::move(t2)), m_op(op) {}
+        virtual ~CombinedTermBehavior(void)
+        {
+            // see ModifiedTermBehavior
+            if (m_term1.use_count() == 1 || m_term2.use_count() == 1)
+            {
+                std::vector<std::shared_ptr<TermBehavior<T>>> stack;
+                stack.push_back(std::move(m_term1));
+                stack.push_back(std::move(m_term2));
+                TermBehavior<T>::release(stack);
+            }
+        }
 
     private:
         CombinedTermBehavior() = delete;
-        CombinedTermBehavior(std::shared_ptr<TermBehavior<T>> t1, std::shared_ptr<TermBehavior<T>> t2, std::function<T(T, T)> f) :
-            m_term1(t1), m_term2(t2), m_combiner(f) {}
         virtual T substitute(const std::vector<T> &values) const
         {
-            return m_combiner(m_term1->substitute(values), m_term2->substitute(values));
+            return combine(m_term1->substitute(values), m_term2->substitute(values));
+        }
+        virtual void substitute(const std::vector<T> *valuesVec, size_t n, T *out,
+            std::vector<std::vector<T>> &columns, size_t level) const
+        {
+            // the second operand goes to the column of this level, the
+            // first one may use it meanwhile
+            if (columns.size() <= level)
+                columns.resize(level + 1);
+            if (columns[level].size() < n)
+                columns[level].resize(n);
+            m_term1->substitute(valuesVec, n, out, columns, level);
+            T *rhs = columns[level].data();
+            m_term2->substitute(valuesVec, n, rhs, columns, level + 1);
+            combine(out, rhs, n);
+        }
+        virtual void collectVariables(std::vector<size_t> & /*indices*/) const {}
+        virtual void describe(TermNode<T> &node) const
+        {
+            node.kind = TERM_COMBINED;
+            node.op = m_op;
+            node.combiner = &m_combiner;
+            node.operands[0] = m_term1.get();
+            node.operands[1] = m_term2.get();
+        }
+        virtual size_t operands(const TermBehavior<T> *ops[2]) const
+        {
+            ops[0] = m_term1.get();
+            ops[1] = m_term2.get();
+            return 2;
+        }
+        virtual T combine(T a, T b) const
+        {
+            if (m_op == OP_CUSTOM)
+                return m_combiner(a, b);
+            return applyOperation(m_op, a, b);
+        }
+        virtual void combine(T *a, const T *b, size_t n) const
+        {
+            if (m_op == OP_CUSTOM)
+            {
+                for (size_t r = 0; r < n; ++r)
+                    a[r] = m_combiner(a[r], b[r]);
+            }
+            else
+                applyOperation(m_op, a, b, n);
+        }
+        virtual void detachOperands(std::vector<std::shared_ptr<TermBehavior<T>>> &stack)
+        {
+            stack.push_back(std::move(m_term1));
+            stack.push_back(std::move(m_term2));
         }
     };
 
@@ -0,0 +1,119 @@
+// -----------------------------------------------------------
+// TermNumbering class
+// Responsibility: Philipp Paier
+//
+// DESCRIPTION:
+// numbers the distinct nodes of terms, so (sub)terms that are
+// built separately but compute the same get the same number.
+// nodes with the same built-in operation on the same numbered
+// operands are equal, as are constants with the same value and
+// variables with the same index. user defined functions are
+// only equal if the node object is shared.
+// -----------------------------------------------------------
+
+#pragma once
+
+#include "Inspection.h"
+
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tc
+{
+
+    template <typename T>
+    class TermNumbering final
+    {
+    public:
+        // input of a node without that operand
+        static const size_t NO_INPUT = ~size_t(0);
+
+    private:
+        // -0 and +0 compare equal but are different constants (1/x),
+        // the last field tells them apart
+        typedef std::tuple<int, int, size_t, size_t, T, bool> NodeKey;
+
+        std::map<const TermBehavior<T>*, size_t> m_visited;
+        std::map<NodeKey, size_t> m_keys;
+        size_t m_size;
+
+    public:
+        TermNumbering() : m_size(0) {}
+        ~TermNumbering() {}
+
+        // number of distinct nodes so far
+        size_t size() const { return m_size; }
+
+        // -----------------------------------------------------------
+        // the number of a term. newNode(node, input1, input2) is
+        // called for every new number in ascending order, inputs are
+        // the numbers of the operands (the index of a variable in
+        // input1). the operands come first, by a walk without
+        // recursion as generated terms can be thousands of nodes deep
+        // -----------------------------------------------------------
+        template <typename NewNode>
+        size_t number(const TermBehavior<T> *root, NewNode &newNode)
+        {
+            std::vector<std::pair<const TermBehavior<T>*, bool>> todo(1, std::make_pair(root, false));
+            while (!todo.empty())
+            {
+                const TermBehavior<T> *tb = todo.back().first;
+                if (m_visited.count(tb))
+                {
+                    todo.pop_back();
+                    continue;
+                }
+
+                const TermNode<T> node = Inspection<T>::node(*tb);
+                if (!todo.back().second)
+                {
+                    todo.back().second = true;
+                    for (size_t i = 2; i > 0; --i)
+                        if (node.operands[i - 1])
+                            todo.push_back(std::make_pair(node.operands[i - 1], false));
+                    continue;
+                }
+
+                todo.pop_back();
+                m_visited[tb] = add(node, newNode);
+            }
+
+            return m_visited[root];
+        }
+
+    private:
+        template <typename NewNode>
+        size_t add(const TermNode<T> &node, NewNode &newNode)
+        {
+            const size_t input1 = node.kind == TERM_VARIABLE ? node.index :
+                (node.operands[0] ? m_visited[node.operands[0]] : NO_INPUT);
+            const size_t input2 = node.operands[1] ? m_visited[node.operands[1]] : NO_INPUT;
+
+            // NaN constants would break the ordering of the keys
+            const bool shareable = (node.kind == TERM_CONST || node.kind == TERM_VARIABLE || node.op != OP_CUSTOM) &&
+                node.value == node.value;
+            if (shareable)
+            {
+                NodeKey key(node.kind, node.op, input1, input2, node.value,
+                    isNegativeZero(node.value, std::is_floating_point<T>()));
+                auto it = m_keys.find(key);
+                if (it != m_keys.end())
+                    return it->second;
+                m_keys[key] = m_size;
+            }
+
+            newNode(node, input1, input2);
+            return m_size++;
+        }
+
+        static bool isNegativeZero(T val, std::true_type) { return val == T() && std::signbit(val); }
+        static bool isNegativeZero(T, std::false_type) { return false; }
+    };
+
+    template <typename T> const size_t TermNumbering<T>::NO_INPUT;
+
+}